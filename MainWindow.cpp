@@ -20,6 +20,7 @@
 #include "MainWindow.h"
 #include "MatParser.h"
 #include "MatReader.h"
+#include "MatLoader.h"
 #include <QtDebug>
 #include <QFile>
 #include <QTreeWidget>
@@ -35,6 +36,7 @@
 #include <QFontMetrics>
 #include <QAction>
 #include <QInputDialog>
+#include <QStatusBar>
 #include <ctype.h>
 using namespace Mat;
 
@@ -115,6 +117,7 @@ MainWindow::MainWindow(QWidget *parent)
 
 	QMenu* fm = mb->addMenu(tr("&File"));
 	fm->addAction(tr("Open..."), this, SLOT(onOpen()), tr("CTRL+O") );
+	fm->addAction(tr("Cancel loading"), this, SLOT(onCancelLoading()), tr("ESC") );
 	fm->addAction(tr("Save log..."), this, SLOT(onSaveLog()) );
 	fm->addAction(tr("Save text..."), this, SLOT(onSaveText()) );
 	fm->addAction(tr("Save array..."), this, SLOT(onSaveArray()) );
@@ -148,12 +151,18 @@ MainWindow::MainWindow(QWidget *parent)
 	connect( a, SIGNAL(triggered()), d_tree, SLOT(collapseAll()) );
 	d_tree->addAction( a );
 
+	d_loader = new MatLoader(this);
+	connect( d_loader, SIGNAL(variableLoaded(int,QVariant)), this, SLOT(onVariableLoaded(int,QVariant)) );
+	connect( d_loader, SIGNAL(progress(int,qint64,qint64)), this, SLOT(onProgress(int,qint64,qint64)) );
+	connect( d_loader, SIGNAL(loaded(int)), this, SLOT(onLoaded(int)) );
+
 	clearAll();
 }
 
 MainWindow::~MainWindow()
 {
-	
+	d_loader->cancel();
+	d_loader->wait();
 }
 
 bool MainWindow::showFile(const QString &path)
@@ -165,53 +174,60 @@ bool MainWindow::showFile(const QString &path)
 		QMessageBox::critical( this, title, tr("Cannot open file for reading:\n%1").arg(path) );
 		return false;
 	}
-	MatReader r;
-	r.setLimit(d_limit);
-	if( !r.setDevice(&file) )
+	file.close();
+	if( d_loader->isRunning() )
 	{
-		QMessageBox::critical( this, title, tr("The file has an invalid format:\n%1").arg(path) );
-		return false;
+		d_loader->cancel();
+		d_loader->wait();
 	}
 	clearAll();
 	d_fileName = path;
 	d_log->append( tr("Parsing file '%1'").arg(path) );
 	if( d_limit )
 		d_log->append( tr("Array lengths are limited to %1 elements!").arg(d_limit) );
+	d_tab->setCurrentIndex( _TreeTab );
+	setWindowTitle( tr("%1 - MAT5 Viewer").arg( QFileInfo(path).fileName() ) );
+	d_loader->setLimit(d_limit);
+	d_loader->setPreview(true);
+	return d_loader->load( path );
+}
 
-	QApplication::setOverrideCursor( Qt::WaitCursor );
-	QVariantList elems;
-	QVariant v = r.nextElement();
-	int errs = 0;
-	if( r.hasError() )
-	{
-		d_log->append( tr("##Error: %1").arg( r.getError() ) );
-		errs++;
-	}
-	while( v.isValid() )
+void MainWindow::onCancelLoading()
+{
+	if( d_loader->isRunning() )
 	{
-		elems.append(v);
-		d_log->append( tr("Parsed '%1' %2").arg(v.typeName()).arg( v.toString() ) );
-		v = r.nextElement();
-		if( r.hasError() )
-		{
-			d_log->append( tr("##Error: %1").arg( r.getError() ) );
-			errs++;
-		}
+		d_loader->cancel();
+		d_log->append( tr("Parsing canceled") );
 	}
-	buildTree( elems );
-	QApplication::restoreOverrideCursor();
-	if( errs )
+}
+
+void MainWindow::onVariableLoaded(int run, const QVariant & v)
+{
+	if( run != d_loader->getRun() )
+		return; // noch in der Queue stehendes Signal eines abgebrochenen Laufs
+	createItem( 0, v );
+	d_log->append( tr("Parsed '%1' %2").arg(v.typeName()).arg( v.toString() ) );
+}
+
+void MainWindow::onProgress(int run, qint64 done, qint64 total)
+{
+	if( run == d_loader->getRun() && total > 0 )
+		statusBar()->showMessage( tr("Parsing %1%").arg( done * 100 / total ) );
+}
+
+void MainWindow::onLoaded(int run)
+{
+	if( run != d_loader->getRun() )
+		return;
+	statusBar()->clearMessage();
+	if( !d_loader->getError().isEmpty() )
 	{
+		d_log->append( tr("##Error: %1").arg( d_loader->getError() ) );
 		d_tab->setCurrentIndex( _LogTab );
-		QMessageBox::critical( this, title, tr("There were parsing errors.\nOnly parts of the file could be read.") );
+		QMessageBox::critical( this, tr("Open MAT5 File"), tr("There were parsing errors.\nOnly parts of the file could be read.") );
 		d_log->append( tr("Parsing completed with errors") );
-	}else
-	{
-		d_tab->setCurrentIndex( _TreeTab );
+	}else if( !d_loader->isCanceled() )
 		d_log->append( tr("Parsing completed successfully") );
-	}
-	setWindowTitle( tr("%1 - MAT5 Viewer").arg( QFileInfo(path).fileName() ) );
-	return true;
 }
 
 bool MainWindow::parseToLog(const QString &path)
@@ -246,6 +262,8 @@ bool MainWindow::parseToLog(const QString &path)
 		switch( t.d_type )
 		{
 		case MatParser::Value:
+			if( t.d_value.canConvert<NumericBuffer>() )
+				t.d_value = t.d_value.value<NumericBuffer>().toVariant();
 			if( flags )
 			{
 				QVariantList l = t.d_value.toList();
@@ -507,7 +525,7 @@ void MainWindow::onSetLimit()
 {
 	bool ok;
 	const int limit = QInputDialog::getInteger( this, tr("Set Array Element Limit"), tr("Maximum number of elements (0..all):"),
-							  d_limit, 0, 32000, 1, &ok );
+							  d_limit, 0, 0x7fffffff, 1, &ok );
 	if( !ok || d_limit == limit )
 		return;
 	d_limit = limit;
@@ -527,12 +545,6 @@ void MainWindow::clearAll()
 	d_found.clear();
 }
 
-void MainWindow::buildTree(const QVariantList & l)
-{
-	foreach( const QVariant& v, l )
-		createItem( 0, v );
-}
-
 static inline QString _nameOrEmpty( const QByteArray& name )
 {
 	if( name.isEmpty() )
@@ -579,11 +591,11 @@ QTreeWidgetItem* MainWindow::createItem(QTreeWidgetItem *p, const QVariant &v)
 		item->setText( _NameCol, _nameOrEmpty(m.d_name) );
 		item->setText( _TypeCol, "NumArray" );
 		item->setText( _ValueCol, _dims( m.d_dims ) );
-		QTreeWidgetItem* real = createItem( item, m.d_real );
+		QTreeWidgetItem* real = createItem( item, m.d_real.toList() );
 		real->setText( _NameCol, "#real");
 		if( !m.d_img.isEmpty() )
 		{
-			QTreeWidgetItem* img = createItem( item, m.d_img );
+			QTreeWidgetItem* img = createItem( item, m.d_img.toList() );
 			img->setText( _NameCol, "#imaginary");
 		}
 	}else if( v.canConvert<Mat::String>())
@@ -644,8 +656,18 @@ QTreeWidgetItem* MainWindow::createItem(QTreeWidgetItem *p, const QVariant &v)
 		item->setData( _NameCol, Qt::UserRole, v );
 		item->setText( _NameCol, _nameOrEmpty(m.d_name) );
 		item->setText( _TypeCol, "SparseArray" );
-		item->setText( _ValueCol, "<not yet supported>" );
-
+		item->setText( _ValueCol, _dims( m.d_dims ) );
+		QTreeWidgetItem* ir = createItem( item, m.d_ir.toList() );
+		ir->setText( _NameCol, "#ir");
+		QTreeWidgetItem* jc = createItem( item, m.d_jc.toList() );
+		jc->setText( _NameCol, "#jc");
+		QTreeWidgetItem* real = createItem( item, m.d_real.toList() );
+		real->setText( _NameCol, "#real");
+		if( !m.d_img.isEmpty() )
+		{
+			QTreeWidgetItem* img = createItem( item, m.d_img.toList() );
+			img->setText( _NameCol, "#imaginary");
+		}
 	}else if( v.canConvert<Mat::Undocumented>())
 	{
 		Mat::Undocumented m = v.value<Mat::Undocumented>();
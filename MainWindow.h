@@ -28,6 +28,10 @@ class QTextBrowser;
 class QTreeWidget;
 class QListWidget;
 class QTreeWidgetItem;
+namespace Mat
+{
+	class MatLoader;
+}
 
 class MainWindow : public QMainWindow
 {
@@ -36,9 +40,9 @@ class MainWindow : public QMainWindow
 public:
 	MainWindow(QWidget *parent = 0);
 	~MainWindow();
-	bool showFile( const QString& path );
+	bool showFile( const QString& path ); // laedt im Hintergrund; die Variablen erscheinen laufend im Tree
 	bool parseToLog( const QString& path );
-	void setLimit( quint16 l ) { d_limit = l; }
+	void setLimit( quint32 l ) { d_limit = l; }
 protected slots:
 	void onOpen();
 	void onParseToLog();
@@ -53,9 +57,12 @@ protected slots:
 	void onFindValue();
 	void onFindAgain();
 	void onSetLimit();
+	void onCancelLoading();
+	void onVariableLoaded( int run, const QVariant& );
+	void onProgress( int run, qint64 done, qint64 total );
+	void onLoaded( int run );
 protected:
 	void clearAll();
-	void buildTree( const QVariantList& );
 	QTreeWidgetItem *createItem( QTreeWidgetItem* p, const QVariant& v );
 private:
 	QTabWidget* d_tab;
@@ -65,8 +72,9 @@ private:
 	QListWidget* d_list;
 	QString d_fileName;
 	QList<QTreeWidgetItem *> d_found;
+	Mat::MatLoader* d_loader;
 	int d_curFound;
-	quint16 d_limit;
+	quint32 d_limit;
 };
 
 #endif // MAINWINDOW_H
@@ -24,11 +24,17 @@ SOURCES += \
     ../Mat5/MatWriter.cpp \
     ../Mat5/MatReader.cpp \
     ../Mat5/MatParser.cpp \
-    ../Mat5/MatLexer.cpp
+    ../Mat5/MatLexer.cpp \
+    ../Mat5/MatBuffer.cpp \
+    ../Mat5/MatDocument.cpp \
+    ../Mat5/MatLoader.cpp
 
 HEADERS  += \
     ../Mat5/qtiocompressor.h \
     ../Mat5/MatWriter.h \
     ../Mat5/MatReader.h \
     ../Mat5/MatParser.h \
-    ../Mat5/MatLexer.h
+    ../Mat5/MatLexer.h \
+    ../Mat5/MatBuffer.h \
+    ../Mat5/MatDocument.h \
+    ../Mat5/MatLoader.h
@@ -44,10 +44,16 @@ SOURCES += main.cpp\
     MatLexer.cpp \
     MatParser.cpp \
     MatReader.cpp \
+    MatBuffer.cpp \
+    MatDocument.cpp \
+    MatLoader.cpp \
     qtiocompressor.cpp
 
 HEADERS  += MainWindow.h \
     MatLexer.h \
     MatParser.h \
     MatReader.h \
+    MatBuffer.h \
+    MatDocument.h \
+    MatLoader.h \
     qtiocompressor.h
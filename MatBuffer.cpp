@@ -0,0 +1,375 @@
+/*
+* Copyright 2016-2018 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the Mat5 library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.info.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this file may be used under the terms of the GNU Lesser
+* General Public License version 3 as published by the Free Software
+* Foundation and appearing in the file LICENSE.LGPL included in the
+* packaging of this file. Please review the following information to
+* ensure the GNU Lesser General Public License version 3 requirements
+* will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+*/
+
+#include "MatBuffer.h"
+#include <QtDebug>
+#include <stdlib.h>
+using namespace Mat;
+
+NumericBuffer::NumericBuffer(quint8 type, qint64 count):d_type(type)
+{
+	Q_ASSERT( elementSize( type ) > 0 );
+	if( !resize( count ) )
+		d_type = Invalid;
+}
+
+NumericBuffer::NumericBuffer(quint8 type, const QByteArray & bytes):d_bytes(bytes),d_type(type)
+{
+	Q_ASSERT( elementSize( type ) > 0 );
+	if( d_bytes.size() % elementSize( type ) != 0 )
+		d_bytes.truncate( size() * elementSize( type ) );
+}
+
+NumericBuffer NumericBuffer::fromRawData(quint8 type, const char * data, qint64 count, BufferOwner * owner)
+{
+	// data wird nicht kopiert; owner muss den Speicher mindestens so lange halten wie der Buffer existiert.
+	// Schreibzugriffe ueber data<T>() fuehren zu einer Kopie.
+	NumericBuffer res;
+	if( count < 0 || count * elementSize( type ) > MaxBytes )
+		return res;
+	res.d_type = type;
+	res.d_bytes = QByteArray::fromRawData( data, count * elementSize( type ) );
+	res.d_owner = owner;
+	return res;
+}
+
+qint32 NumericBuffer::size() const
+{
+	const quint8 len = elementSize( d_type );
+	if( len == 0 )
+		return 0;
+	else
+		return d_bytes.size() / len;
+}
+
+bool NumericBuffer::resize(qint64 count)
+{
+	const qint64 len = count * elementSize( d_type );
+	if( count < 0 || len > MaxBytes )
+		return false;
+	d_bytes.resize( len );
+	return true;
+}
+
+void NumericBuffer::append(const NumericBuffer & rhs)
+{
+	Q_ASSERT( rhs.d_type == d_type );
+	d_bytes.append( rhs.d_bytes );
+}
+
+template<class T>
+static inline void _fill( QByteArray& bytes, T v )
+{
+	T* p = reinterpret_cast<T*>( bytes.data() );
+	const qint32 count = bytes.size() / sizeof(T);
+	for( qint32 i = 0; i < count; i++ )
+		p[i] = v;
+}
+
+void NumericBuffer::fill(const QVariant & v)
+{
+	switch( d_type )
+	{
+	case Int8:
+		_fill( d_bytes, qint8( v.toInt() ) );
+		break;
+	case UInt8:
+		_fill( d_bytes, quint8( v.toUInt() ) );
+		break;
+	case Int16:
+		_fill( d_bytes, qint16( v.toInt() ) );
+		break;
+	case UInt16:
+		_fill( d_bytes, quint16( v.toUInt() ) );
+		break;
+	case Int32:
+		_fill( d_bytes, qint32( v.toInt() ) );
+		break;
+	case UInt32:
+		_fill( d_bytes, quint32( v.toUInt() ) );
+		break;
+	case Single:
+		_fill( d_bytes, float( v.toDouble() ) );
+		break;
+	case Double:
+		_fill( d_bytes, v.toDouble() );
+		break;
+	case Int64:
+		_fill( d_bytes, qint64( v.toLongLong() ) );
+		break;
+	case UInt64:
+		_fill( d_bytes, quint64( v.toULongLong() ) );
+		break;
+	}
+}
+
+template<class S, class D>
+static inline void _convert( const S* from, D* to, qint32 count )
+{
+	// einfache Schleife ohne Abhaengigkeiten, damit der Compiler sie vektorisiert
+	for( qint32 i = 0; i < count; i++ )
+		to[i] = D( from[i] );
+}
+
+template<class D>
+static void _convertFrom( const NumericBuffer& from, D* to )
+{
+	const qint32 count = from.size();
+	switch( from.getType() )
+	{
+	case NumericBuffer::Int8:
+		_convert( from.constData<qint8>(), to, count );
+		break;
+	case NumericBuffer::UInt8:
+		_convert( from.constData<quint8>(), to, count );
+		break;
+	case NumericBuffer::Int16:
+		_convert( from.constData<qint16>(), to, count );
+		break;
+	case NumericBuffer::UInt16:
+		_convert( from.constData<quint16>(), to, count );
+		break;
+	case NumericBuffer::Int32:
+		_convert( from.constData<qint32>(), to, count );
+		break;
+	case NumericBuffer::UInt32:
+		_convert( from.constData<quint32>(), to, count );
+		break;
+	case NumericBuffer::Single:
+		_convert( from.constData<float>(), to, count );
+		break;
+	case NumericBuffer::Double:
+		_convert( from.constData<double>(), to, count );
+		break;
+	case NumericBuffer::Int64:
+		_convert( from.constData<qint64>(), to, count );
+		break;
+	case NumericBuffer::UInt64:
+		_convert( from.constData<quint64>(), to, count );
+		break;
+	}
+}
+
+NumericBuffer NumericBuffer::convertTo(quint8 type, Arena* arena) const
+{
+	if( type == d_type || !isValid() || elementSize( type ) == 0 )
+		return *this;
+	NumericBuffer res;
+	if( qint64(size()) * elementSize( type ) > MaxBytes )
+		return res;
+	char* mem;
+	if( arena )
+		mem = arena->allocate( qint64(size()) * elementSize( type ) );
+	else
+	{
+		res = NumericBuffer( type, size() );
+		mem = res.getRawData();
+	}
+	switch( type )
+	{
+	case Int8:
+		_convertFrom( *this, (qint8*)mem );
+		break;
+	case UInt8:
+		_convertFrom( *this, (quint8*)mem );
+		break;
+	case Int16:
+		_convertFrom( *this, (qint16*)mem );
+		break;
+	case UInt16:
+		_convertFrom( *this, (quint16*)mem );
+		break;
+	case Int32:
+		_convertFrom( *this, (qint32*)mem );
+		break;
+	case UInt32:
+		_convertFrom( *this, (quint32*)mem );
+		break;
+	case Single:
+		_convertFrom( *this, (float*)mem );
+		break;
+	case Double:
+		_convertFrom( *this, (double*)mem );
+		break;
+	case Int64:
+		_convertFrom( *this, (qint64*)mem );
+		break;
+	case UInt64:
+		_convertFrom( *this, (quint64*)mem );
+		break;
+	}
+	if( arena )
+		res = fromRawData( type, mem, size(), arena );
+	return res;
+}
+
+QVariant NumericBuffer::getValue(qint32 i) const
+{
+	if( i < 0 || i >= size() )
+		return QVariant();
+	switch( d_type )
+	{
+	case Int8:
+		return qint32( constData<qint8>()[i] );
+	case UInt8:
+		return qint32( constData<quint8>()[i] );
+	case Int16:
+		return qint32( constData<qint16>()[i] );
+	case UInt16:
+		return qint32( constData<quint16>()[i] );
+	case Int32:
+		return constData<qint32>()[i];
+	case UInt32:
+		return constData<quint32>()[i];
+	case Single:
+		return QVariant::fromValue( constData<float>()[i] );
+	case Double:
+		return constData<double>()[i];
+	case Int64:
+		return qint64( constData<qint64>()[i] );
+	case UInt64:
+		return quint64( constData<quint64>()[i] );
+	}
+	return QVariant();
+}
+
+QVariantList NumericBuffer::toList(qint32 limit) const
+{
+	QVariantList res;
+	const qint32 count = ( limit == 0 ) ? size() : qMin( limit, size() );
+	for( qint32 i = 0; i < count; i++ )
+		res.append( getValue( i ) );
+	return res;
+}
+
+QVariant NumericBuffer::toVariant() const
+{
+	if( size() == 1 )
+		return getValue( 0 );
+	else
+		return toList();
+}
+
+Arena::Arena(qint32 blockSize):d_cur(0),d_left(0),d_used(0),d_blockSize(blockSize)
+{
+}
+
+Arena::~Arena()
+{
+	clear();
+}
+
+char *Arena::allocate(qint64 len)
+{
+	// 8 Byte Ausrichtung genuegt fuer alle Elementtypen
+	len = ( len + 7 ) & ~qint64(7);
+	if( len == 0 )
+		len = 8;
+	d_used += len;
+	if( len > d_blockSize / 4 )
+	{
+		// grosse Buffer erhalten einen eigenen Block, damit der laufende Block nicht verschwendet wird
+		char* p = (char*)::malloc( len );
+		d_blocks.append( p );
+		return p;
+	}
+	if( len > d_left )
+	{
+		d_cur = (char*)::malloc( d_blockSize );
+		d_blocks.append( d_cur );
+		d_left = d_blockSize;
+	}
+	char* p = d_cur;
+	d_cur += len;
+	d_left -= len;
+	return p;
+}
+
+void Arena::clear()
+{
+	foreach( char* p, d_blocks )
+		::free( p );
+	d_blocks.clear();
+	d_cur = 0;
+	d_left = 0;
+	d_used = 0;
+}
+
+quint8 NumericBuffer::elementSize(quint8 type)
+{
+	switch( type )
+	{
+	case Int8:
+	case UInt8:
+		return 1;
+	case Int16:
+	case UInt16:
+		return 2;
+	case Int32:
+	case UInt32:
+	case Single:
+		return 4;
+	case Double:
+	case Int64:
+	case UInt64:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+quint8 NumericBuffer::typeFromMetaType(int metaType)
+{
+	switch( metaType )
+	{
+	case QVariant::Double:
+		return Double;
+	case QVariant::Int:
+	case QMetaType::Long:
+		return Int32;
+	case QVariant::UInt:
+	case QMetaType::ULong:
+		return UInt32;
+	case QVariant::LongLong:
+		return Int64;
+	case QVariant::ULongLong:
+		return UInt64;
+	case QVariant::Bool:
+	case QMetaType::UChar:
+		return UInt8;
+	case QMetaType::Char:
+		return Int8;
+	case QMetaType::Float:
+		return Single;
+	case QMetaType::Short:
+		return Int16;
+	case QMetaType::UShort:
+		return UInt16;
+	default:
+		return Invalid;
+	}
+}
@@ -0,0 +1,130 @@
+#ifndef MATBUFFER_H
+#define MATBUFFER_H
+
+/*
+* Copyright 2016-2018 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the Mat5 library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.info.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this file may be used under the terms of the GNU Lesser
+* General Public License version 3 as published by the Free Software
+* Foundation and appearing in the file LICENSE.LGPL included in the
+* packaging of this file. Please review the following information to
+* ensure the GNU Lesser General Public License version 3 requirements
+* will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+*/
+
+#include <QVariant>
+#include <QSharedData>
+
+namespace Mat
+{
+	// Haelt fremden Speicher am Leben, auf den ein NumericBuffer verweist
+	class BufferOwner : public QSharedData
+	{
+	public:
+		virtual ~BufferOwner() {}
+	};
+
+	// Alloziert fortlaufend aus grossen Bloecken; freigegeben wird nur alles zusammen mit der Arena.
+	// Buffer, die mit fromRawData darauf verweisen, halten die Arena am Leben. Nicht thread-safe.
+	class Arena : public BufferOwner
+	{
+	public:
+		Arena( qint32 blockSize = 1024 * 1024 );
+		~Arena();
+		char* allocate( qint64 len );
+		qint64 getUsed() const { return d_used; }
+		void clear();
+	private:
+		QList<char*> d_blocks;
+		char* d_cur;
+		qint64 d_left;
+		qint64 d_used;
+		qint32 d_blockSize;
+	};
+
+	// Contiguous, typed storage of numeric data; copies share the buffer until written (like QByteArray)
+	class NumericBuffer
+	{
+	public:
+		// Die Werte entsprechen den miXXX Datentypen der Spezifikation
+		enum Type { Invalid = 0, Int8 = 1, UInt8 = 2, Int16 = 3, UInt16 = 4, Int32 = 5, UInt32 = 6,
+					Single = 7, Double = 9, Int64 = 12, UInt64 = 13 };
+		// Obergrenze wegen QByteArray; groessere Elemente (bis 4 GB laut Tag) nur ueber ArrayCursor.
+		// Konstruktor, fromRawData und convertTo liefern darueber einen ungueltigen Buffer.
+		enum { MaxBytes = 0x7fffffff };
+
+		NumericBuffer():d_type(Invalid) {}
+		NumericBuffer( quint8 type, qint64 count );
+		NumericBuffer( quint8 type, const QByteArray& bytes );
+		static NumericBuffer fromRawData( quint8 type, const char* data, qint64 count, BufferOwner* );
+
+		quint8 getType() const { return d_type; }
+		bool isValid() const { return d_type != Invalid; }
+		qint32 size() const;
+		bool isEmpty() const { return size() == 0; }
+		bool resize( qint64 count ); // false und unveraendert bei mehr als MaxBytes
+		void fill( const QVariant& );
+		void append( const NumericBuffer& ); // gleicher Typ vorausgesetzt
+		const QByteArray& getBytes() const { return d_bytes; }
+		char* getRawData() { return d_bytes.data(); }
+
+		template<class T>
+		const T* constData() const
+		{
+			Q_ASSERT( typeOf<T>() == d_type );
+			return reinterpret_cast<const T*>( d_bytes.constData() );
+		}
+		template<class T>
+		T* data()
+		{
+			Q_ASSERT( typeOf<T>() == d_type );
+			return reinterpret_cast<T*>( d_bytes.data() );
+		}
+
+		// wie static_cast je Element; teilt den Speicher bei gleichem Typ, sonst ggf. aus der Arena
+		NumericBuffer convertTo( quint8 type, Arena* = 0 ) const;
+		QVariant getValue( qint32 i ) const;
+		QVariantList toList( qint32 limit = 0 ) const;
+		QVariant toVariant() const; // wie frueher vom Parser geliefert: Skalar oder QVariantList
+
+		static quint8 elementSize( quint8 type );
+		static quint8 typeFromMetaType( int metaType );
+		template<class T>
+		static quint8 typeOf() { return Invalid; }
+	private:
+		QByteArray d_bytes;
+		QExplicitlySharedDataPointer<BufferOwner> d_owner;
+		quint8 d_type;
+	};
+
+	template<> inline quint8 NumericBuffer::typeOf<qint8>() { return Int8; }
+	template<> inline quint8 NumericBuffer::typeOf<quint8>() { return UInt8; }
+	template<> inline quint8 NumericBuffer::typeOf<qint16>() { return Int16; }
+	template<> inline quint8 NumericBuffer::typeOf<quint16>() { return UInt16; }
+	template<> inline quint8 NumericBuffer::typeOf<qint32>() { return Int32; }
+	template<> inline quint8 NumericBuffer::typeOf<quint32>() { return UInt32; }
+	template<> inline quint8 NumericBuffer::typeOf<float>() { return Single; }
+	template<> inline quint8 NumericBuffer::typeOf<double>() { return Double; }
+	template<> inline quint8 NumericBuffer::typeOf<qint64>() { return Int64; }
+	template<> inline quint8 NumericBuffer::typeOf<quint64>() { return UInt64; }
+}
+
+Q_DECLARE_METATYPE(Mat::NumericBuffer)
+
+#endif // MATBUFFER_H
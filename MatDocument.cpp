@@ -0,0 +1,108 @@
+/*
+* Copyright 2016-2018 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the Mat5 library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.info.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this file may be used under the terms of the GNU Lesser
+* General Public License version 3 as published by the Free Software
+* Foundation and appearing in the file LICENSE.LGPL included in the
+* packaging of this file. Please review the following information to
+* ensure the GNU Lesser General Public License version 3 requirements
+* will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+*/
+
+#include "MatDocument.h"
+using namespace Mat;
+
+MatDocument::MatDocument()
+{
+}
+
+MatDocument::~MatDocument()
+{
+	clear();
+}
+
+bool MatDocument::load(QIODevice * in, bool own)
+{
+	clear();
+	d_arena = new Arena();
+	MatReader r;
+	r.setArena( d_arena.data() );
+	if( !r.setDevice( in, own ) )
+	{
+		d_error = "Invalid file format";
+		return false;
+	}
+	while( true )
+	{
+		const QVariant v = r.nextElement();
+		if( r.hasError() )
+		{
+			d_error = r.getError();
+			return false;
+		}
+		if( !v.isValid() )
+			break;
+		d_vars.append( v );
+	}
+	return true;
+}
+
+void MatDocument::clear()
+{
+	// Die Arena wird erst freigegeben, wenn auch alle Buffer freigegeben sind, die darauf verweisen
+	d_vars.clear();
+	d_arena = 0;
+	d_error.clear();
+}
+
+static QByteArray _name( const QVariant& v )
+{
+	if( v.canConvert<NumericArray>() )
+		return v.value<NumericArray>().d_name;
+	else if( v.canConvert<String>() )
+		return v.value<String>().d_name;
+	else if( v.canConvert<Structure>() )
+		return v.value<Structure>().d_name;
+	else if( v.canConvert<CellArray>() )
+		return v.value<CellArray>().d_name;
+	else if( v.canConvert<SparseArray>() )
+		return v.value<SparseArray>().d_name;
+	else if( v.canConvert<Undocumented>() )
+		return v.value<Undocumented>().d_name;
+	else
+		return QByteArray();
+}
+
+QVariant MatDocument::getVariable(const QByteArray &name) const
+{
+	foreach( const QVariant& v, d_vars )
+	{
+		if( _name( v ) == name )
+			return v;
+	}
+	return QVariant();
+}
+
+qint64 MatDocument::getArenaSize() const
+{
+	if( d_arena.data() )
+		return d_arena->getUsed();
+	else
+		return 0;
+}
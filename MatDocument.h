@@ -0,0 +1,56 @@
+#ifndef MATDOCUMENT_H
+#define MATDOCUMENT_H
+
+/*
+* Copyright 2016-2018 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the Mat5 library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.info.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this file may be used under the terms of the GNU Lesser
+* General Public License version 3 as published by the Free Software
+* Foundation and appearing in the file LICENSE.LGPL included in the
+* packaging of this file. Please review the following information to
+* ensure the GNU Lesser General Public License version 3 requirements
+* will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+*/
+
+#include "MatReader.h"
+
+namespace Mat
+{
+	// Haelt alle Variablen einer Datei. Nur die numerischen Nutzdaten (NumericBuffer) liegen in einer
+	// gemeinsamen Arena und werden mit dem Dokument zusammen freigegeben, sofern keine Kopien der Buffer
+	// mehr existieren; Listen, Maps, Namen und Dimensionen werden weiterhin einzeln alloziert.
+	class MatDocument
+	{
+	public:
+		MatDocument();
+		~MatDocument();
+		bool load( QIODevice*, bool own = false );
+		void clear();
+		const QVariantList& getVariables() const { return d_vars; }
+		QVariant getVariable( const QByteArray& name ) const;
+		QString getError() const { return d_error; }
+		qint64 getArenaSize() const;
+	private:
+		QVariantList d_vars;
+		QExplicitlySharedDataPointer<Arena> d_arena;
+		QString d_error;
+	};
+}
+
+#endif // MATDOCUMENT_H
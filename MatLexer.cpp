@@ -29,6 +29,13 @@
 #include <QtDebug>
 #include <QBuffer>
 #include "qtiocompressor.h"
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define MAT_SSE2
+#endif
 using namespace Mat;
 
 void MatLexer::swapByteOrder(char* ptr, quint32 len )
@@ -42,6 +49,97 @@ void MatLexer::swapByteOrder(char* ptr, quint32 len )
 	}
 }
 
+// Portable Varianten; werden auch fuer den Rest nach den SIMD Bloecken verwendet
+static inline void _swap16( char* p, qint64 count )
+{
+	for( qint64 i = 0; i < count; i++, p += 2 )
+	{
+		quint16 v;
+		::memcpy( &v, p, 2 );
+		v = quint16( ( v >> 8 ) | ( v << 8 ) );
+		::memcpy( p, &v, 2 );
+	}
+}
+
+static inline void _swap32( char* p, qint64 count )
+{
+	for( qint64 i = 0; i < count; i++, p += 4 )
+	{
+		quint32 v;
+		::memcpy( &v, p, 4 );
+		v = ( v >> 24 ) | ( ( v >> 8 ) & 0x0000ff00 ) | ( ( v << 8 ) & 0x00ff0000 ) | ( v << 24 );
+		::memcpy( p, &v, 4 );
+	}
+}
+
+static inline void _swap64( char* p, qint64 count )
+{
+	for( qint64 i = 0; i < count; i++, p += 8 )
+	{
+		quint32 lo, hi;
+		::memcpy( &lo, p, 4 );
+		::memcpy( &hi, p + 4, 4 );
+		lo = ( lo >> 24 ) | ( ( lo >> 8 ) & 0x0000ff00 ) | ( ( lo << 8 ) & 0x00ff0000 ) | ( lo << 24 );
+		hi = ( hi >> 24 ) | ( ( hi >> 8 ) & 0x0000ff00 ) | ( ( hi << 8 ) & 0x00ff0000 ) | ( hi << 24 );
+		::memcpy( p, &hi, 4 );
+		::memcpy( p + 4, &lo, 4 );
+	}
+}
+
+void MatLexer::swapBuffer(char * data, quint8 elemSize, qint64 count)
+{
+	// Verarbeitet zuerst ganze Register und den Rest portabel; data muss nicht ausgerichtet sein
+	qint64 done = 0;
+#if defined(__AVX2__)
+	const qint64 perReg = ( elemSize > 1 ) ? 32 / elemSize : 0;
+	if( perReg )
+	{
+		__m256i mask;
+		if( elemSize == 2 )
+			mask = _mm256_setr_epi8( 1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+									 1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14 );
+		else if( elemSize == 4 )
+			mask = _mm256_setr_epi8( 3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+									 3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12 );
+		else
+			mask = _mm256_setr_epi8( 7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,
+									 7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8 );
+		for( ; done + perReg <= count; done += perReg )
+		{
+			__m256i* p = reinterpret_cast<__m256i*>( data + done * elemSize );
+			_mm256_storeu_si256( p, _mm256_shuffle_epi8( _mm256_loadu_si256( p ), mask ) );
+		}
+	}
+#elif defined(MAT_SSE2)
+	// SSE2 hat kein Byte Shuffle; Woerter werden mit shufflelo/hi umgestellt, Bytes mit Shifts getauscht
+	const qint64 perReg = ( elemSize > 1 ) ? 16 / elemSize : 0;
+	for( ; perReg && done + perReg <= count; done += perReg )
+	{
+		__m128i* p = reinterpret_cast<__m128i*>( data + done * elemSize );
+		__m128i v = _mm_loadu_si128( p );
+		if( elemSize == 4 )
+			v = _mm_shufflehi_epi16( _mm_shufflelo_epi16( v, 0xb1 ), 0xb1 );
+		else if( elemSize == 8 )
+			v = _mm_shufflehi_epi16( _mm_shufflelo_epi16( v, 0x1b ), 0x1b );
+		v = _mm_or_si128( _mm_slli_epi16( v, 8 ), _mm_srli_epi16( v, 8 ) );
+		_mm_storeu_si128( p, v );
+	}
+#endif
+	char* rest = data + done * elemSize;
+	switch( elemSize )
+	{
+	case 2:
+		_swap16( rest, count - done );
+		break;
+	case 4:
+		_swap32( rest, count - done );
+		break;
+	case 8:
+		_swap64( rest, count - done );
+		break;
+	}
+}
+
 static quint8 calcPadding( quint32 len, quint32 boundary )
 {
 	const int rem = len % boundary;
@@ -65,7 +163,7 @@ void MatLexer::readPadding(int len, int boundary )
 	}
 }
 
-MatLexer::MatLexer(bool byteSwap):d_in(0),d_needByteSwap(byteSwap)
+MatLexer::MatLexer(bool byteSwap):d_in(0),d_start(0),d_needByteSwap(byteSwap)
 {
 }
 
@@ -119,10 +217,32 @@ bool MatLexer::setDevice(QIODevice * in, bool own, bool expectHeader)
 	d_in = in;
 	d_owner = own;
 	d_keep = 0;
+	d_start = ( in->isSequential() ) ? 0 : in->pos();
 
 	return true;
 }
 
+bool MatLexer::setMapping(bool on)
+{
+	// Nur unkomprimierte Elemente einer QFile koennen direkt aus dem Mapping gelesen werden
+	if( !on )
+	{
+		d_map = 0;
+		return true;
+	}
+	QFile* f = qobject_cast<QFile*>( d_in );
+	if( f == 0 || f->fileName().isEmpty() )
+		return false;
+	MappedFile* m = new MappedFile( f->fileName() );
+	if( !m->isValid() )
+	{
+		delete m;
+		return false;
+	}
+	d_map = m;
+	return true;
+}
+
 bool MatLexer::setDevice(MatLexer::InStream * in)
 {
 	if( in == 0 )
@@ -132,12 +252,34 @@ bool MatLexer::setDevice(MatLexer::InStream * in)
 	d_in = in;
 	d_keep = in;
 	d_owner = false;
+	d_start = 0;
 	return true;
 }
 
-MatLexer::DataElement MatLexer::nextElement()
+bool MatLexer::seek(qint64 pos)
 {
-	enum { miCOMPRESSED = 15 };
+	if( d_in == 0 || d_keep.data() != 0 || d_in->isSequential() )
+		return false;
+	return d_in->seek( pos );
+}
+
+void MatLexer::discard()
+{
+	if( d_keep.data() )
+		d_keep->discard();
+}
+
+void MatLexer::reset()
+{
+	release();
+	d_keep = 0;
+	d_map = 0;
+	d_start = 0;
+}
+
+MatLexer::DataElement MatLexer::nextElement(bool inlineSmall, Arena* arena)
+{
+	enum { miINT8 = 1, miMATRIX = 14, miCOMPRESSED = 15 };
 
 	if( d_in == 0 || d_in->atEnd() )
 		return DataElement();
@@ -148,6 +290,7 @@ MatLexer::DataElement MatLexer::nextElement()
 
 	DataElement e;
 	e.d_end = false;
+	e.d_pos = filePos( d_in );
 	if( peek[1] != 0 || peek[2] != 0 ) // Die Bedingung im Handbuch ist falsch!
 	{
 		// Small Data Element Format
@@ -175,7 +318,22 @@ MatLexer::DataElement MatLexer::nextElement()
 		if( len > 4 )
 			return DataElement(true);
 		e.d_type = type;
-		e.d_stream = new InStream(d_in,len, calcPadding(len,4) );
+		e.d_size = 8;
+		if( inlineSmall && arena != 0 && type != miINT8 && NumericBuffer::elementSize( type ) > 0 )
+		{
+			char* mem = arena->allocate( 4 );
+			if( readBlock( d_in, mem, 4 ) != 4 )
+				return DataElement(true);
+			e.d_data = QByteArray::fromRawData( mem, len );
+			e.d_inArena = true;
+		}else if( inlineSmall )
+		{
+			e.d_data.resize( 4 );
+			if( readBlock( d_in, e.d_data.data(), 4 ) != 4 )
+				return DataElement(true);
+			e.d_data.truncate( len );
+		}else
+			e.d_stream = new InStream(d_in,len, calcPadding(len,4) );
 	}else
 	{
 		// tttt nnnn
@@ -186,7 +344,7 @@ MatLexer::DataElement MatLexer::nextElement()
 
 		// Normal Format
 		qint32 type;
-		qint32 len;
+		quint32 len; // bis 4 GB
 		if( read( d_in, type, d_needByteSwap ) != 4 ) // zuerst Type !
 			return DataElement(true);
 		if( read( d_in, len, d_needByteSwap ) != 4 )
@@ -194,6 +352,8 @@ MatLexer::DataElement MatLexer::nextElement()
 		if( type == miCOMPRESSED )
 		{
 			// komprimierte Daten haben kein Padding am Schluss
+			e.d_compressed = true;
+			e.d_size = 8 + qint64(quint32(len));
 			e.d_stream = new InStream( d_in, len, 0, true );
 			if( read( e.d_stream.data(), type, d_needByteSwap ) != 4 ) // zuerst Type !
 				return DataElement(true);
@@ -203,19 +363,87 @@ MatLexer::DataElement MatLexer::nextElement()
 		}else
 		{
 			e.d_type = type;
-			e.d_stream = new InStream(d_in, len, calcPadding( len, 8 ) );
+			e.d_size = 8 + qint64(quint32(len)) + calcPadding( len, 8 );
+			if( inlineSmall && quint32(len) <= InlineLimit && arena != 0 && type != miINT8 &&
+					NumericBuffer::elementSize( type ) > 0 )
+			{
+				// ohne Zwischenkopie; das Padding wird mitgelesen
+				const qint64 n = e.d_size - 8;
+				char* mem = arena->allocate( n );
+				if( readBlock( d_in, mem, n ) != n )
+					return DataElement(true);
+				e.d_data = QByteArray::fromRawData( mem, len );
+				e.d_inArena = true;
+			}else if( inlineSmall && type != miMATRIX && quint32(len) <= InlineLimit )
+			{
+				e.d_data.resize( e.d_size - 8 );
+				if( readBlock( d_in, e.d_data.data(), e.d_data.size() ) != e.d_data.size() )
+					return DataElement(true);
+				e.d_data.truncate( len );
+			}else
+				e.d_stream = new InStream(d_in, len, calcPadding( len, 8 ) );
 		}
 
 	}
 	return e;
 }
 
-void MatLexer::readAll()
+void MatLexer::skipAll()
 {
+	if( d_keep.data() )
+		d_keep->skipAll();
+	else if( d_in != 0 )
+		skip( d_in, d_in->bytesAvailable() );
+}
+
+qint64 MatLexer::filePos(const QIODevice * in)
+{
+	if( in == 0 )
+		return -1;
+	if( const InStream* s = dynamic_cast<const InStream*>( in ) )
+		return s->filePos();
+	if( in->isSequential() )
+		return -1;
+	return in->pos();
+}
+
+qint64 MatLexer::readBlock(QIODevice * in, char * data, qint64 len)
+{
+	qint64 done = 0;
+	while( done < len )
+	{
+		const qint64 n = in->read( data + done, len - done );
+		if( n <= 0 )
+			break;
+		done += n;
+	}
+	return done;
+}
+
+qint64 MatLexer::skip(QIODevice * in, qint64 len)
+{
+	if( in == 0 || len <= 0 )
+		return 0;
+	if( InStream* s = dynamic_cast<InStream*>( in ) )
+		return s->skip( len );
+	if( !in->isSequential() )
+	{
+		const qint64 n = qMin( len, in->size() - in->pos() );
+		if( n <= 0 || !in->seek( in->pos() + n ) )
+			return 0;
+		return n;
+	}
 	QByteArray tmp;
-	tmp.resize( 64000 );
-	while( d_in->read( tmp.data(), tmp.size() ) > 0 )
-		;
+	tmp.resize( qMin( len, qint64(64000) ) );
+	qint64 done = 0;
+	while( done < len )
+	{
+		const qint64 n = in->read( tmp.data(), qMin( len - done, qint64(tmp.size()) ) );
+		if( n <= 0 )
+			break;
+		done += n;
+	}
+	return done;
 }
 
 void MatLexer::release()
@@ -227,7 +455,7 @@ void MatLexer::release()
 }
 
 MatLexer::InStream::InStream(QIODevice *in, quint32 len, quint8 padding, bool compressed):
-	d_in(in),d_len(len),d_padding(padding),d_compressed(compressed)
+	d_in(in),d_raw(0),d_len(len),d_padding(padding),d_compressed(compressed)
 {
 	Q_ASSERT( in != 0 );
 	if( compressed )
@@ -236,6 +464,7 @@ MatLexer::InStream::InStream(QIODevice *in, quint32 len, quint8 padding, bool co
 		d_padding = 0;
 		InStream* inorig = new InStream( in, len, padding );
 		inorig->setParent(this);
+		d_raw = inorig;
 		QtIOCompressor* incom = new QtIOCompressor( inorig );
 		incom->setParent(this);
 		if( !incom->open(QIODevice::ReadOnly) )
@@ -245,6 +474,22 @@ MatLexer::InStream::InStream(QIODevice *in, quint32 len, quint8 padding, bool co
 	QIODevice::open(QIODevice::ReadOnly);
 }
 
+MatLexer::MappedFile::MappedFile(const QString & path):d_file(path),d_data(0),d_size(0)
+{
+	if( d_file.open( QIODevice::ReadOnly ) )
+	{
+		d_size = d_file.size();
+		if( d_size > 0 )
+			d_data = d_file.map( 0, d_size );
+	}
+}
+
+MatLexer::MappedFile::~MappedFile()
+{
+	if( d_data )
+		d_file.unmap( d_data );
+}
+
 MatLexer::InStream::~InStream()
 {
 	if( d_len > 0 || d_padding > 0 )
@@ -277,6 +522,63 @@ qint64 MatLexer::InStream::readData(char *data, qint64 maxSize)
 		return -1;
 }
 
+qint64 MatLexer::InStream::filePos() const
+{
+	if( d_compressed )
+		return -1;
+	const qint64 pos = MatLexer::filePos( d_in );
+	if( pos < 0 )
+		return -1;
+	// QIODevice liest auf Vorrat; was im Puffer liegt, ist im File schon konsumiert
+	return pos - QIODevice::bytesAvailable();
+}
+
+qint64 MatLexer::InStream::skip(qint64 len)
+{
+	qint64 done = 0;
+	const qint64 buffered = qMin( len, QIODevice::bytesAvailable() );
+	if( buffered > 0 )
+	{
+		const QByteArray tmp = read( buffered );
+		done += tmp.size();
+	}
+	if( done < len )
+	{
+		if( d_compressed )
+			done += MatLexer::skip( d_in, len - done );
+		else if( d_len > 0 )
+		{
+			const qint64 n = MatLexer::skip( d_in, qMin( len - done, qint64(d_len) ) );
+			d_len -= n;
+			done += n;
+			if( d_len == 0 )
+				eatPadding();
+		}
+	}
+	return done;
+}
+
+void MatLexer::InStream::skipAll()
+{
+	if( d_compressed )
+	{
+		// Die komprimierten Bytes werden anhand der Laenge im aeusseren Tag uebersprungen; danach
+		// liest der Stream direkt vom leeren Rohstream und steht am Ende.
+		read( QIODevice::bytesAvailable() );
+		d_raw->skip( d_raw->bytesAvailable() );
+		d_in = d_raw;
+	}else
+		skip( bytesAvailable() );
+}
+
+void MatLexer::InStream::discard()
+{
+	d_len = 0;
+	d_padding = 0;
+	if( d_raw )
+		d_raw->discard();
+}
+
 void MatLexer::InStream::eatPadding()
 {
 	QByteArray rest;
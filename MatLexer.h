@@ -30,6 +30,8 @@
 
 #include <QIODevice>
 #include <QSharedData>
+#include <QFile>
+#include "MatBuffer.h"
 
 namespace Mat
 {
@@ -44,12 +46,17 @@ namespace Mat
 			qint64 bytesAvailable () const;
 			bool isSequential() const { return true; }
 			quint32 getLen() const { return d_len; }
+			qint64 filePos() const; // -1 wenn komprimiert oder nicht ermittelbar
+			qint64 skip( qint64 len );
+			void skipAll(); // bei compressed ohne Inflate bis zum Ende des aeusseren Elements
+			void discard(); // keine Warnung, wenn vorzeitig geloescht
 		protected:
 			qint64 readData( char * data, qint64 maxSize );
 			qint64 writeData(const char *, qint64 ) { return -1; }
 			void eatPadding();
 		private:
 			QIODevice* d_in;
+			InStream* d_raw; // bei compressed der Stream mit den komprimierten Bytes
 			quint32 d_len;
 			quint8 d_padding;
 			bool d_compressed;
@@ -66,11 +73,33 @@ namespace Mat
 			return count;
 		}
 
+		class MappedFile : public BufferOwner
+		{
+		public:
+			MappedFile( const QString& path );
+			~MappedFile();
+			bool isValid() const { return d_data != 0; }
+			const char* getData() const { return (const char*)d_data; }
+			qint64 getSize() const { return d_size; }
+		private:
+			QFile d_file;
+			uchar* d_data;
+			qint64 d_size;
+		};
+
 		MatLexer(bool byteSwap = false);
 		~MatLexer();
 
 		bool setDevice( QIODevice*, bool own = false, bool expectHeader = true );
 		bool setDevice( InStream* );
+		bool setMapping( bool on );
+		QIODevice* getDevice() const { return d_in; }
+		InStream* getStream() const { return d_keep.data(); }
+		bool seek( qint64 pos ); // nur auf oberster Ebene mit nicht-sequentiellem Device
+		qint64 getStart() const { return d_start; }
+		void discard();
+		void reset(); // gibt Device und Stream frei, damit der Lexer wiederverwendet werden kann
+		MappedFile* getMapping() const { return d_map.data(); }
 		bool needsByteSwap() const { return d_needByteSwap; }
 
 		struct DataElement
@@ -78,12 +107,27 @@ namespace Mat
 			quint8 d_type;
 			bool d_error;
 			bool d_end;
+			bool d_compressed;
+			qint64 d_pos; // Position des Tags im File oder -1
+			qint64 d_size; // inkl. Tag und Padding
 			QExplicitlySharedDataPointer<InStream> d_stream;
-			DataElement():d_type(0),d_error(false),d_end(true){}
-			DataElement(bool e):d_type(0),d_error(e),d_end(true){}
+			QByteArray d_data; // Nutzdaten kleiner Elemente, falls mit inlineSmall gelesen; d_stream ist dann 0
+			bool d_inArena; // d_data verweist ohne Kopie in die Arena
+			DataElement():d_type(0),d_error(false),d_end(true),d_compressed(false),d_pos(-1),d_size(0),
+				d_inArena(false){}
+			DataElement(bool e):d_type(0),d_error(e),d_end(true),d_compressed(false),d_pos(-1),d_size(0),
+				d_inArena(false){}
 		};
-		DataElement nextElement();
-		void readAll();
+		enum { InlineLimit = 256 };
+		// inlineSmall: Elemente bis InlineLimit Bytes (ausser miMATRIX) werden sofort nach d_data gelesen,
+		// ohne dafuer einen InStream zu erzeugen; numerische Nutzdaten (ausser miINT8) direkt in die Arena
+		DataElement nextElement( bool inlineSmall = false, Arena* = 0 );
+		void skipAll(); // Rest der Ebene; unkomprimiert per seek
+		static qint64 skip( QIODevice*, qint64 len );
+		static qint64 readBlock( QIODevice*, char* data, qint64 len ); // wiederholt read bis len oder Ende
+		static qint64 filePos( const QIODevice* );
+		// dreht die Byte Order von count Elementen der Groesse elemSize (1, 2, 4 oder 8) an Ort und Stelle
+		static void swapBuffer( char* data, quint8 elemSize, qint64 count );
 	protected:
 		void release();
 		static void swapByteOrder(char* ptr, quint32 len );
@@ -91,6 +135,8 @@ namespace Mat
 	private:
 		QIODevice* d_in;
 		QExplicitlySharedDataPointer<InStream> d_keep;
+		QExplicitlySharedDataPointer<MappedFile> d_map;
+		qint64 d_start;
 		bool d_needByteSwap;
 		bool d_owner;
 	};
@@ -0,0 +1,117 @@
+/*
+* Copyright 2016-2018 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the Mat5 library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.info.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this file may be used under the terms of the GNU Lesser
+* General Public License version 3 as published by the Free Software
+* Foundation and appearing in the file LICENSE.LGPL included in the
+* packaging of this file. Please review the following information to
+* ensure the GNU Lesser General Public License version 3 requirements
+* will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+*/
+
+#include "MatLoader.h"
+using namespace Mat;
+
+MatLoader::MatLoader(QObject *parent):QThread(parent),d_run(0),d_limit(0),d_preview(false)
+{
+}
+
+MatLoader::~MatLoader()
+{
+	cancel();
+	wait();
+}
+
+bool MatLoader::load(const QString &path)
+{
+	if( isRunning() )
+		return false;
+	d_path = path;
+	d_error.clear();
+	d_run++;
+	d_cancel.fetchAndStoreOrdered( 0 );
+	start();
+	return true;
+}
+
+void MatLoader::cancel()
+{
+	d_cancel.fetchAndStoreOrdered( 1 );
+}
+
+bool MatLoader::isCanceled() const
+{
+#if QT_VERSION >= 0x050000
+	return d_cancel.loadAcquire() != 0;
+#else
+	return d_cancel != 0;
+#endif
+}
+
+void MatLoader::run()
+{
+	const int run = d_run;
+	readFile( run );
+	emit loaded( run );
+}
+
+void MatLoader::readFile(int run)
+{
+	File file( d_path, this );
+	if( !file.open( QIODevice::ReadOnly ) )
+	{
+		d_error = "Cannot open file for reading";
+		return;
+	}
+	const qint64 total = file.size();
+	MatReader r;
+	r.setLimit( d_limit );
+	r.setPreview( d_preview );
+	if( !r.setDevice( &file, false, true ) )
+	{
+		if( !isCanceled() )
+			d_error = "Invalid file format";
+		return;
+	}
+	emit progress( run, 0, total );
+	while( !isCanceled() )
+	{
+		const QVariant v = r.nextElement();
+		if( isCanceled() )
+			break; // v ist nach einem abgebrochenen Lesen unvollstaendig
+		if( r.hasError() )
+		{
+			d_error = r.getError();
+			break;
+		}
+		if( !v.isValid() )
+			break;
+		emit variableLoaded( run, v );
+		emit progress( run, file.pos(), total );
+	}
+	if( d_error.isEmpty() && !isCanceled() )
+		emit progress( run, total, total );
+}
+
+qint64 MatLoader::File::readData(char *data, qint64 maxlen)
+{
+	if( d_loader->isCanceled() )
+		return -1;
+	return QFile::readData( data, maxlen );
+}
@@ -0,0 +1,83 @@
+#ifndef MATLOADER_H
+#define MATLOADER_H
+
+/*
+* Copyright 2016-2018 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the Mat5 library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.info.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this file may be used under the terms of the GNU Lesser
+* General Public License version 3 as published by the Free Software
+* Foundation and appearing in the file LICENSE.LGPL included in the
+* packaging of this file. Please review the following information to
+* ensure the GNU Lesser General Public License version 3 requirements
+* will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+*/
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QFile>
+#include "MatReader.h"
+
+namespace Mat
+{
+	// Liest eine Datei auf einem eigenen Thread; jede Variable auf oberster Ebene wird gemeldet, sobald sie
+	// dekodiert ist. Ein Abbruch wirkt beim naechsten Lesen vom File, also auch innerhalb einer Variable.
+	// Alle Signale tragen die Nummer des Laufs; nach cancel und wait koennen noch Signale des alten Laufs
+	// in der Queue des Empfaengers stehen, die dieser an getRun erkennt.
+	class MatLoader : public QThread
+	{
+		Q_OBJECT
+	public:
+		// Liefert nach cancel bei jedem Lesen -1, so dass der Parser sofort abbricht
+		class File : public QFile
+		{
+		public:
+			File( const QString& path, const MatLoader* loader ):QFile(path),d_loader(loader) {}
+		protected:
+			qint64 readData( char* data, qint64 maxlen );
+		private:
+			const MatLoader* d_loader;
+		};
+
+		MatLoader( QObject* parent = 0 );
+		~MatLoader(); // bricht ab und wartet
+		bool load( const QString& path ); // false, falls bereits ein Lauf aktiv ist
+		int getRun() const { return d_run; } // Nummer des zuletzt mit load gestarteten Laufs
+		void setLimit( quint32 l ) { d_limit = l; }
+		void setPreview( bool on ) { d_preview = on; }
+		void cancel();
+		bool isCanceled() const;
+		QString getError() const { return d_error; } // nach loaded; leer bei Abbruch
+	signals:
+		void variableLoaded( int run, const QVariant& );
+		void progress( int run, qint64 done, qint64 total ); // in Bytes
+		void loaded( int run ); // letztes Signal eines Laufs, auch nach Fehler oder Abbruch
+	protected:
+		void run();
+	private:
+		void readFile( int run );
+		QString d_path;
+		QString d_error;
+		QAtomicInt d_cancel;
+		int d_run;
+		quint32 d_limit;
+		bool d_preview;
+	};
+}
+
+#endif // MATLOADER_H
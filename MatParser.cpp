@@ -27,8 +27,10 @@
 
 #include "MatParser.h"
 #include "MatLexer.h"
+#include "MatBuffer.h"
 #include <QBuffer>
 #include <QVector>
+#include <QtDebug>
 using namespace Mat;
 
 enum DataType { miINT8 = 1, miUINT8 = 2, miINT16 = 3, miUINT16 = 4, miINT32 = 5, miUINT32 = 6,
@@ -36,7 +38,8 @@ enum DataType { miINT8 = 1, miUINT8 = 2, miINT16 = 3, miUINT16 = 4, miINT32 = 5,
 				miCOMPRESSED = 15,
 				miUTF8 = 16, miUTF16 = 17, miUTF32 = 18 };
 
-MatParser::MatParser():d_limit(0)
+MatParser::MatParser():d_elemPos(-1),d_elemSize(0),d_limit(0),d_elemCompressed(false),
+	d_preview(false),d_truncated(false),d_tail(false)
 {
 }
 
@@ -45,11 +48,36 @@ MatParser::~MatParser()
 	releaseLexer();
 }
 
-bool MatParser::setDevice(QIODevice * in, bool own)
+bool MatParser::setDevice(QIODevice * in, bool own, bool mapped)
 {
 	releaseLexer();
 	d_lex.append( new MatLexer() );
-	return d_lex.first()->setDevice( in, own );
+	if( !d_lex.first()->setDevice( in, own ) )
+		return false;
+	if( mapped && !d_lex.first()->setMapping( true ) )
+		qWarning() << "MatParser: cannot map file, reading conventionally";
+	return true;
+}
+
+bool MatParser::setElementDevice(QIODevice * in, bool byteSwap)
+{
+	releaseLexer();
+	d_lex.append( new MatLexer( byteSwap ) );
+	return d_lex.first()->setDevice( in, false, false );
+}
+
+QIODevice *MatParser::getDevice() const
+{
+	if( d_lex.isEmpty() )
+		return 0;
+	return d_lex.first()->getDevice();
+}
+
+bool MatParser::needsByteSwap() const
+{
+	if( d_lex.isEmpty() )
+		return false;
+	return d_lex.first()->needsByteSwap();
 }
 
 MatParser::Token MatParser::nextToken()
@@ -64,31 +92,51 @@ MatParser::Token MatParser::nextToken()
 	}
 	// else
 
-	MatLexer::DataElement e = d_lex.last()->nextElement();
+	if( d_truncated )
+	{
+		if( d_lex.size() > 1 )
+		{
+			d_lex.last()->discard();
+			recycle( d_lex.takeLast() );
+			return Token(EndMatrix);
+		}
+		d_truncated = false;
+		if( !d_lex.first()->seek( d_elemPos + d_elemSize ) )
+			return Token(Error, "Cannot seek to next element");
+	}
+
+	MatLexer::DataElement e = d_lex.last()->nextElement( true, d_arena.data() );
 	if( e.d_end )
 	{
 		if( d_lex.size() > 1 )
 		{
-			delete d_lex.last();
-			d_lex.removeLast();
+			recycle( d_lex.takeLast() );
 			return Token(EndMatrix);
 		}else
 			return Token(Null);
 	}else if( e.d_error )
 		return Token(Error, "Lexer Error" );
 	// else
+	if( d_lex.size() == 1 )
+	{
+		d_elemPos = e.d_pos;
+		d_elemSize = e.d_size;
+		d_elemCompressed = e.d_compressed;
+	}
 	switch( e.d_type )
 	{
 	case miMATRIX:
-		{
-			d_lex.append( new MatLexer( d_lex.first()->needsByteSwap() ) );
-			d_lex.last()->setDevice( e.d_stream.data() );
-		}
+		enterMatrix( e );
 		return Token(BeginMatrix);
 	case miCOMPRESSED:
 		return Token(Error, "miCOMPRESSED");
 	default:
-		return readValue( e.d_stream.data(), e.d_type );
+		{
+			const Token t = ( e.d_stream.data() == 0 ) ? readValue( e.d_data, e.d_type, e.d_inArena ) :
+														 readValue( e.d_stream.data(), e.d_type );
+			d_tail = false;
+			return t;
+		}
 	}
 	Q_ASSERT( false );
 	return Token(Error);
@@ -101,12 +149,98 @@ MatParser::Token MatParser::peekToken()
 	return d_peek;
 }
 
+bool MatParser::truncate()
+{
+	if( !d_preview || d_limit == 0 || !d_elemCompressed || d_elemPos < 0 || d_lex.size() < 2 )
+		return false;
+	d_truncated = true;
+	return true;
+}
+
 void MatParser::skipLevel()
 {
 	if( d_lex.size() > 1 )
 	{
-		d_lex.last()->readAll();
+		d_lex.last()->skipAll();
+	}
+}
+
+MatLexer::DataElement MatParser::nextDataElement()
+{
+	Q_ASSERT( !d_lex.isEmpty() );
+	if( d_peek.d_type != Null )
+		return MatLexer::DataElement(true);
+	return d_lex.last()->nextElement();
+}
+
+void MatParser::enterMatrix(const MatLexer::DataElement & e)
+{
+	Q_ASSERT( e.d_stream.data() != 0 );
+	MatLexer* lex = ( d_pool.isEmpty() ) ? new MatLexer( d_lex.first()->needsByteSwap() ) : d_pool.takeLast();
+	lex->setDevice( e.d_stream.data() );
+	d_lex.append( lex );
+}
+
+MatLexer::InStream *MatParser::getMatrixStream() const
+{
+	if( d_lex.size() < 2 )
+		return 0;
+	return d_lex.last()->getStream();
+}
+
+void MatParser::leaveMatrix(MatLexer::InStream * matrix)
+{
+	if( matrix == 0 || d_lex.size() < 2 || d_lex.last()->getStream() != matrix )
+		return;
+	d_peek = Token();
+	matrix->skipAll();
+	recycle( d_lex.takeLast() );
+}
+
+bool MatParser::captureMatrix(qint64 &pos, qint64 &len, QByteArray &raw)
+{
+	if( d_peek.d_type != BeginMatrix )
+		return false;
+	d_peek = Token();
+	Q_ASSERT( d_lex.size() > 1 );
+	MatLexer::InStream* in = d_lex.last()->getStream();
+	len = in->bytesAvailable();
+	pos = in->filePos();
+	bool ok;
+	if( pos >= 0 )
+		ok = MatLexer::skip( in, len ) == len;
+	else
+	{
+		raw = in->readAll();
+		ok = raw.size() == len;
 	}
+	recycle( d_lex.takeLast() );
+	return ok;
+}
+
+bool MatParser::seek(qint64 pos)
+{
+	if( d_lex.isEmpty() )
+		return false;
+	d_peek = Token();
+	d_truncated = false;
+	d_tail = false;
+	while( d_lex.size() > 1 )
+	{
+		d_lex.last()->discard();
+		recycle( d_lex.takeLast() );
+	}
+	d_elemPos = -1;
+	d_elemSize = 0;
+	d_elemCompressed = false;
+	return d_lex.first()->seek( pos );
+}
+
+bool MatParser::rewind()
+{
+	if( d_lex.isEmpty() )
+		return false;
+	return seek( d_lex.first()->getStart() );
 }
 
 void MatParser::releaseLexer()
@@ -114,88 +248,228 @@ void MatParser::releaseLexer()
 	foreach( MatLexer* lex, d_lex )
 		delete lex;
 	d_lex.clear();
+	foreach( MatLexer* lex, d_pool )
+		delete lex;
+	d_pool.clear(); // die Byte Order haengt vom Device ab
+}
+
+void MatParser::recycle(MatLexer * lex)
+{
+	// Lexer der inneren Ebenen werden wiederverwendet statt je miMATRIX neu erzeugt
+	lex->reset();
+	d_pool.append( lex );
 }
 
 
 template<class T>
-static MatParser::Token _read( QIODevice* in, bool swap, const char* name, int limit )
+static MatParser::Token _read( QIODevice* in, bool swap, const char* name, quint32 limit, Arena* arena )
 {
-	QVariantList tmp;
-	int i = 0;
-	while( !in->atEnd() )
+	qint64 count = in->bytesAvailable() / sizeof(T);
+	if( limit != 0 && count > limit )
+		count = limit;
+	if( count * qint64(sizeof(T)) > qint64(NumericBuffer::MaxBytes) )
+		return MatParser::Token(MatParser::Error, QString("%1 element too large, use MatReader::openArray").arg(name) );
+	// Ein Block statt ein read pro Element; die Byte Order wird danach im Buffer gedreht
+	NumericBuffer buf;
+	const qint64 len = qint64(count) * sizeof(T);
+	char* data;
+	if( arena )
+		data = arena->allocate( len );
+	else
 	{
-		if( limit != 0 && i >= limit )
-		{
-			in->readAll();
-			break;
-		}
-		T v;
-		if( MatLexer::read( in, v, swap ) != sizeof(T) )
-			return MatParser::Token(MatParser::Error, name );
-		else
-			tmp.append(v);
-		i++;
+		buf = NumericBuffer( NumericBuffer::typeOf<T>(), count );
+		data = buf.getRawData();
 	}
-	if( tmp.size() == 1 )
-		return MatParser::Token(MatParser::Value,tmp.first());
-	else
-		return MatParser::Token(MatParser::Value,tmp);
+	if( MatLexer::readBlock( in, data, len ) != len )
+		return MatParser::Token(MatParser::Error, name );
+	if( swap )
+		MatLexer::swapBuffer( data, sizeof(T), count );
+	if( arena )
+		buf = NumericBuffer::fromRawData( NumericBuffer::typeOf<T>(), data, count, arena );
+	return MatParser::Token(MatParser::Value, QVariant::fromValue(buf) );
+}
+
+template<class T>
+static bool _map( MatLexer::MappedFile* map, QIODevice* in, quint32 limit, QVariant& out )
+{
+	// Zero-Copy: der Buffer zeigt direkt ins Mapping, sofern das Element unkomprimiert und ausgerichtet ist
+	MatLexer::InStream* s = dynamic_cast<MatLexer::InStream*>( in );
+	if( s == 0 )
+		return false;
+	const qint64 pos = s->filePos();
+	const qint64 avail = in->bytesAvailable();
+	if( pos < 0 || pos + avail > map->getSize() )
+		return false;
+	const char* data = map->getData() + pos;
+	if( quintptr(data) % sizeof(T) != 0 )
+		return false;
+	qint64 count = avail / sizeof(T);
+	if( limit != 0 && count > limit )
+		count = limit;
+	if( count * qint64(sizeof(T)) > qint64(NumericBuffer::MaxBytes) )
+		return false;
+	out = QVariant::fromValue( NumericBuffer::fromRawData( NumericBuffer::typeOf<T>(), data, count, map ) );
+	MatLexer::skip( in, avail );
+	return true;
 }
 
 MatParser::Token MatParser::readValue(QIODevice* in, quint8 type)
 {
 	Q_ASSERT( !d_lex.isEmpty() );
 	const bool swap = d_lex.first()->needsByteSwap();
+	MatLexer::MappedFile* map = d_lex.first()->getMapping();
+	if( map != 0 && !swap )
+	{
+		QVariant v;
+		bool ok = false;
+		switch( type )
+		{
+		case miUINT8:
+			ok = _map<quint8>( map, in, d_limit, v );
+			break;
+		case miINT16:
+			ok = _map<qint16>( map, in, d_limit, v );
+			break;
+		case miUINT16:
+			ok = _map<quint16>( map, in, d_limit, v );
+			break;
+		case miINT32:
+			ok = _map<qint32>( map, in, d_limit, v );
+			break;
+		case miUINT32:
+			ok = _map<quint32>( map, in, d_limit, v );
+			break;
+		case miSINGLE:
+			ok = _map<float>( map, in, d_limit, v );
+			break;
+		case miDOUBLE:
+			ok = _map<double>( map, in, d_limit, v );
+			break;
+		case miINT64:
+			ok = _map<qint64>( map, in, d_limit, v );
+			break;
+		case miUINT64:
+			ok = _map<quint64>( map, in, d_limit, v );
+			break;
+		}
+		if( ok )
+			return Token(Value, v );
+	}
+	Token t;
 	switch( type )
 	{
-	case miINT8: // ASCII-Names werden laut MATLAB Spec als miINT8 Array abgespeichert
-		return Token(Value, in->readAll() ); // ByteArray wird nur Limitiert, wenn nicht als Char Array verwendet
 	case miUINT8:
-		return _read<quint8>( in, swap, "miUINT8", d_limit );
+		t = _read<quint8>( in, swap, "miUINT8", d_limit, d_arena.data() );
+		break;
 	case miINT16:
-		return _read<qint16>( in, swap, "miINT16", d_limit );
+		t = _read<qint16>( in, swap, "miINT16", d_limit, d_arena.data() );
+		break;
 	case miUINT16:
-		return _read<quint16>( in, swap, "miUINT16", d_limit );
+		t = _read<quint16>( in, swap, "miUINT16", d_limit, d_arena.data() );
+		break;
 	case miINT32:
-		return _read<qint32>( in, swap, "miINT32", d_limit );
+		t = _read<qint32>( in, swap, "miINT32", d_limit, d_arena.data() );
+		break;
 	case miUINT32:
-		return _read<quint32>( in, swap, "miUINT32", d_limit );
+		t = _read<quint32>( in, swap, "miUINT32", d_limit, d_arena.data() );
+		break;
 	case miSINGLE:
-		return _read<float>( in, swap, "miSINGLE", d_limit );
+		t = _read<float>( in, swap, "miSINGLE", d_limit, d_arena.data() );
+		break;
 	case miDOUBLE:
-		return _read<double>( in, swap, "miDOUBLE", d_limit );
+		t = _read<double>( in, swap, "miDOUBLE", d_limit, d_arena.data() );
+		break;
 	case miINT64:
-		return _read<qint64>( in, swap, "miINT64", d_limit );
+		t = _read<qint64>( in, swap, "miINT64", d_limit, d_arena.data() );
+		break;
 	case miUINT64:
-		return _read<quint64>( in, swap, "miUINT64", d_limit );
+		t = _read<quint64>( in, swap, "miUINT64", d_limit, d_arena.data() );
+		break;
+	}
+	if( t.d_type != Null )
+	{
+		// Rest nach dem Limit
+		if( t.d_type == Value && !in->atEnd() )
+		{
+			MatLexer::InStream* s = dynamic_cast<MatLexer::InStream*>( in );
+			if( s != 0 && d_tail && truncate() )
+				s->discard();
+			else
+				MatLexer::skip( in, in->bytesAvailable() );
+		}
+		return t;
+	}
+	switch( type )
+	{
+	case miINT8:
 	case miUTF8:
-		return Token(Value, QString::fromUtf8( in->readAll() ) ); //  Strings ohne Limit
 	case miUTF16:
+	case miUTF32:
+		return readValue( in->readAll(), type );
+	}
+	return Token(Error, "Invalid type");
+}
+
+MatParser::Token MatParser::readValue(const QByteArray& data, quint8 type, bool inArena)
+{
+	Q_ASSERT( !d_lex.isEmpty() );
+	const bool swap = d_lex.first()->needsByteSwap();
+	switch( type )
+	{
+	case miUINT8:
+	case miINT16:
+	case miUINT16:
+	case miINT32:
+	case miUINT32:
+	case miSINGLE:
+	case miDOUBLE:
+	case miINT64:
+	case miUINT64:
 		{
-			QVector<ushort> tmp;
-			while( !in->atEnd() )
+			// die mi Typen entsprechen NumericBuffer::Type
+			const quint8 len = NumericBuffer::elementSize( type );
+			qint32 count = data.size() / len;
+			if( d_limit != 0 && quint32(count) > d_limit )
+				count = d_limit;
+			NumericBuffer buf;
+			if( inArena )
 			{
-				ushort v;
-				if( MatLexer::read( in, v, swap ) != 2 )
-					return Token(Error, "miUTF16");
-				else
-					tmp.append(v);
+				Q_ASSERT( d_arena.data() != 0 );
+				char* mem = const_cast<char*>( data.constData() ); // gehoert der Arena, nicht dem QByteArray
+				if( swap )
+					MatLexer::swapBuffer( mem, len, count );
+				buf = NumericBuffer::fromRawData( type, mem, count, d_arena.data() );
+			}else
+			{
+				buf = NumericBuffer( type, data );
+				buf.resize( count );
+				if( swap )
+					MatLexer::swapBuffer( buf.getRawData(), len, count );
 			}
-			return Token(Value, QString::fromUtf16( tmp.data(), tmp.size() ) );
+			return Token(Value, QVariant::fromValue(buf) );
+		}
+	case miINT8: // ASCII-Names werden laut MATLAB Spec als miINT8 Array abgespeichert
+		return Token(Value, data ); // ByteArray wird nur Limitiert, wenn nicht als Char Array verwendet
+	case miUTF8:
+		return Token(Value, QString::fromUtf8( data ) ); //  Strings ohne Limit
+	case miUTF16:
+		{
+			QByteArray tmp = data;
+			if( tmp.size() % 2 != 0 )
+				return Token(Error, "miUTF16");
+			if( swap )
+				MatLexer::swapBuffer( tmp.data(), 2, tmp.size() / 2 );
+			return Token(Value, QString::fromUtf16( (const ushort*)tmp.constData(), tmp.size() / 2 ) );
 		}
 		break;
 	case miUTF32:
 		{
-			QVector<uint> tmp;
-			while( !in->atEnd() )
-			{
-				uint v;
-				if( MatLexer::read( in, v, swap ) != 4 )
-					return Token(Error, "miUTF32");
-				else
-					tmp.append(v);
-			}
-			return Token(Value, QString::fromUcs4( tmp.data(), tmp.size() ) ); 
+			QByteArray tmp = data;
+			if( tmp.size() % 4 != 0 )
+				return Token(Error, "miUTF32");
+			if( swap )
+				MatLexer::swapBuffer( tmp.data(), 4, tmp.size() / 4 );
+			return Token(Value, QString::fromUcs4( (const uint*)tmp.constData(), tmp.size() / 4 ) );
 		}
 		break;
 	}
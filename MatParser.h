@@ -29,12 +29,10 @@
 */
 
 #include <QVariant>
-
-class QIODevice;
+#include "MatLexer.h"
 
 namespace Mat
 {
-	class MatLexer;
 
 	class MatParser
 	{
@@ -49,19 +47,61 @@ namespace Mat
 
 		MatParser();
 		~MatParser();
-		bool setDevice( QIODevice*, bool own = false );
+		bool setDevice( QIODevice*, bool own = false, bool mapped = false ); // mapped nur fuer QFile
+		bool setElementDevice( QIODevice*, bool byteSwap ); // Inhalt eines miMATRIX ohne File Header
+		QIODevice* getDevice() const;
+		bool needsByteSwap() const;
 		Token nextToken();
 		Token peekToken();
-		quint16 getLimit() const { return d_limit; }
-		void setLimit(quint16 l) { d_limit = l; }
+		quint32 getLimit() const { return d_limit; }
+		void setLimit(quint32 l) { d_limit = l; }
+		Arena* getArena() const { return d_arena.data(); }
+		void setArena( Arena* a ) { d_arena = a; } // numerische Nutzdaten werden dort alloziert; haelt eine Referenz
 		void skipLevel();
+		// Preview: bei gesetztem Limit wird eine komprimierte Variable nach dem limitierten Teil abgebrochen,
+		// statt den Rest zu inflaten; nextToken liefert dann EndMatrix fuer jede offene Ebene und setzt
+		// anhand der Laenge im aeusseren Tag mit der naechsten Variable fort. Setzt ein Device mit seek voraus.
+		void setPreview( bool on ) { d_preview = on; }
+		bool isPreview() const { return d_preview; }
+		// Gilt fuer den naechsten Wert: danach wird von der Variable nichts mehr benoetigt, so dass ein
+		// limitierter Wert die Variable abbrechen darf; sonst wird nur der Rest des Werts uebersprungen.
+		void setTail( bool on ) { d_tail = on; }
+		bool truncate(); // true, falls die aktuelle Variable abgebrochen wird; sonst skipLevel verwenden
+		bool isTruncated() const { return d_truncated; }
+		bool seek( qint64 pos ); // setzt auf oberste Ebene zurueck und positioniert dort
+		bool rewind();
+		int getPoolSize() const { return d_pool.size(); }
+		qint64 getElementPos() const { return d_elemPos; } // des zuletzt gelesenen Elements auf oberster Ebene
+		qint64 getElementSize() const { return d_elemSize; }
+		bool isElementCompressed() const { return d_elemCompressed; }
+		// Unmittelbar nach peekToken()==BeginMatrix: uebernimmt den Inhalt der Matrix ohne zu dekodieren; pos ist
+		// die Position auf dem Device oder -1, wenn nicht adressierbar, dann stehen die Bytes in raw.
+		bool captureMatrix( qint64& pos, qint64& len, QByteArray& raw );
+		// Naechstes Element der aktuellen Ebene ohne es zu lesen; miMATRIX wird nicht gesondert behandelt
+		MatLexer::DataElement nextDataElement();
+		// Oeffnet ein mit nextDataElement gelesenes miMATRIX wie nextToken mit BeginMatrix
+		void enterMatrix( const MatLexer::DataElement& );
+		MatLexer::InStream* getMatrixStream() const; // der innersten Ebene, 0 auf oberster
+		// Ueberspringt den Rest der Ebene ohne zu dekodieren, sofern matrix noch die innerste ist
+		void leaveMatrix( MatLexer::InStream* matrix );
+		// Nutzdaten eines Elements; inArena: die Bytes liegen bereits in der Arena und werden referenziert
+		Token readValue( const QByteArray&, quint8 type, bool inArena = false );
 	protected:
 		void releaseLexer();
 		Token readValue( QIODevice *in, quint8 type );
+		void recycle( MatLexer* );
 	private:
 		QList<MatLexer*> d_lex;
+		QList<MatLexer*> d_pool; // freie Lexer fuer innere Ebenen
 		Token d_peek;
-		quint16 d_limit; // 0..alles
+		QExplicitlySharedDataPointer<Arena> d_arena;
+		qint64 d_elemPos;
+		qint64 d_elemSize;
+		quint32 d_limit; // 0..alles
+		bool d_elemCompressed;
+		bool d_preview;
+		bool d_truncated;
+		bool d_tail;
 	};
 }
 
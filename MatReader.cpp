@@ -27,6 +27,11 @@
 
 #include "MatReader.h"
 #include "MatParser.h"
+#include <QBuffer>
+#include <QFile>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
 #include <QtDebug>
 using namespace Mat;
 
@@ -36,7 +41,29 @@ enum ArrayType { mxCELL_CLASS = 1, mxSTRUCT_CLASS = 2, mxOBJECT_CLASS = 3, mxCHA
 				 mxUINT32_CLASS = 13, mxINT64_CLASS = 14, mxUINT64_CLASS = 15,
 				 mxUndocumented16 = 16, mxUndocumented17 = 17 };
 
-MatReader::MatReader()
+struct MatReader::Selection
+{
+	// Baum der gewaehlten Pfade; d_fields fuer Variablen und Felder, d_items fuer {i} und (i)
+	QMap<QByteArray,Selection*> d_fields;
+	QMap<qint32,Selection*> d_items;
+	bool d_all; // Pfad endet hier
+	Selection():d_all(false) {}
+	~Selection() { qDeleteAll( d_fields ); qDeleteAll( d_items ); }
+	Selection* clone() const
+	{
+		Selection* s = new Selection();
+		s->d_all = d_all;
+		QMap<QByteArray,Selection*>::const_iterator i;
+		for( i = d_fields.begin(); i != d_fields.end(); ++i )
+			s->d_fields[ i.key() ] = i.value()->clone();
+		QMap<qint32,Selection*>::const_iterator j;
+		for( j = d_items.begin(); j != d_items.end(); ++j )
+			s->d_items[ j.key() ] = j.value()->clone();
+		return s;
+	}
+};
+
+MatReader::MatReader():d_sel(0),d_cur(0),d_dirValid(false),d_lazy(false),d_columnar(false),d_tail(false)
 {
 	d_parser = new MatParser();
 }
@@ -44,16 +71,116 @@ MatReader::MatReader()
 MatReader::~MatReader()
 {
 	delete d_parser;
+	if( d_sel )
+		delete d_sel;
+}
+
+static bool _isIdentChar( char ch )
+{
+	return ( ch >= 'a' && ch <= 'z' ) || ( ch >= 'A' && ch <= 'Z' ) || ( ch >= '0' && ch <= '9' ) || ch == '_';
+}
+
+bool MatReader::setSelection(const QList<QByteArray> &paths)
+{
+	if( d_sel )
+		delete d_sel;
+	d_sel = 0;
+	if( paths.isEmpty() )
+		return true;
+	d_sel = new Selection();
+	foreach( const QByteArray& path, paths )
+	{
+		Selection* s = d_sel;
+		int i = 0;
+		bool field = true;
+		while( i < path.size() )
+		{
+			const char ch = path[i];
+			if( ch == '.' )
+			{
+				field = true;
+				i++;
+				continue;
+			}
+			Selection** sub = 0;
+			if( field && _isIdentChar( ch ) )
+			{
+				const int start = i;
+				while( i < path.size() && _isIdentChar( path[i] ) )
+					i++;
+				sub = &s->d_fields[ path.mid( start, i - start ) ];
+			}else if( ch == '{' || ch == '(' )
+			{
+				const int end = path.indexOf( ( ch == '{' ) ? '}' : ')', i );
+				bool ok;
+				const qint32 index = path.mid( i + 1, end - i - 1 ).trimmed().toInt( &ok );
+				if( end < 0 || !ok || index < 1 )
+					break;
+				sub = &s->d_items[ index ];
+				i = end + 1;
+			}else
+				break;
+			field = false;
+			if( *sub == 0 )
+				*sub = new Selection();
+			s = *sub;
+		}
+		if( i < path.size() || s == d_sel )
+		{
+			qWarning() << "MatReader::setSelection: invalid path" << path;
+			delete d_sel;
+			d_sel = 0;
+			return false;
+		}
+		s->d_all = true;
+	}
+	return true;
+}
+
+const MatReader::Selection* MatReader::select( const Selection* s, qint32 item, const QByteArray& field,
+											 bool& selected )
+{
+	// Gibt die Auswahl fuer das Element zurueck, 0 = ganz dekodieren; selected false = ueberspringen
+	selected = true;
+	if( s == 0 || s->d_all )
+		return 0;
+	const Selection* sub = s->d_items.value( item + 1 );
+	if( sub && !field.isNull() )
+		sub = ( sub->d_all ) ? sub : sub->d_fields.value( field );
+	if( sub == 0 && !field.isNull() )
+		sub = s->d_fields.value( field );
+	if( sub == 0 )
+	{
+		selected = false;
+		return 0;
+	}
+	return ( sub->d_all ) ? 0 : sub;
 }
 
-bool MatReader::setDevice(QIODevice * in, bool own)
+bool MatReader::setDevice(QIODevice * in, bool own, bool mapped)
 {
-	return d_parser->setDevice( in, own );
+	d_dir.clear();
+	d_dirValid = false;
+	d_src.clear();
+	return d_parser->setDevice( in, own, mapped );
 }
 
 QVariant MatReader::nextElement()
+{
+	while( true )
+	{
+		const QVariant v = readElement();
+		// readMatrix liefert fuer nicht gewaehlte Variablen ein leeres Resultat
+		if( v.isValid() || hasError() || d_sel == 0 || d_parser->peekToken().d_type == MatParser::Null )
+			return v;
+	}
+}
+
+QVariant MatReader::readElement()
 {
 	d_error.clear();
+	d_cur = d_sel;
+	d_tail = true;
 	MatParser::Token t = d_parser->nextToken();
 	switch( t.d_type )
 	{
@@ -80,34 +207,544 @@ QVariant MatReader::nextElement()
 	return QVariant();
 }
 
-quint16 MatReader::getLimit() const
+quint32 MatReader::getLimit() const
 {
 	return d_parser->getLimit();
 }
 
-void MatReader::setLimit(quint16 l)
+void MatReader::setLimit(quint32 l)
 {
 	d_parser->setLimit(l);
 }
 
-static inline qint32 _totalCount( const QVector<qint32>& v )
+void MatReader::setPreview(bool on)
+{
+	d_parser->setPreview(on);
+}
+
+bool MatReader::isPreview() const
+{
+	return d_parser->isPreview();
+}
+
+Arena *MatReader::getArena() const
+{
+	return d_parser->getArena();
+}
+
+void MatReader::setArena(Arena * a)
+{
+	d_parser->setArena(a);
+}
+
+const Directory& MatReader::readDirectory()
 {
-	qint32 res = 1;
+	if( d_dirValid )
+		return d_dir;
+	d_error.clear();
+	d_dir.clear();
+	if( !d_parser->rewind() )
+	{
+		error("Device does not support seeking");
+		return d_dir;
+	}
+	while( true )
+	{
+		MatParser::Token t = d_parser->nextToken();
+		if( t.d_type == MatParser::Null )
+			break;
+		else if( t.d_type == MatParser::Error )
+		{
+			d_error = t.d_value.toString();
+			break;
+		}
+		Variable v;
+		v.d_offset = d_parser->getElementPos();
+		v.d_size = d_parser->getElementSize();
+		v.d_compressed = d_parser->isElementCompressed();
+		if( v.d_offset < 0 )
+		{
+			error("Device does not support seeking");
+			break;
+		}
+		if( t.d_type == MatParser::BeginMatrix )
+		{
+			// Nur Flags, Dimensionen und Name lesen; der Rest wird uebersprungen
+			quint32 flags = 0;
+			quint32 nzmax = 0;
+			if( d_parser->peekToken().d_type != MatParser::EndMatrix &&
+					readHeader( flags, nzmax, v.d_dims, v.d_name ) )
+				v.d_class = flags & 0xff;
+			if( !d_error.isEmpty() )
+				break;
+			d_dir.append( v );
+		}
+		if( !d_parser->seek( v.d_offset + v.d_size ) )
+		{
+			error("Cannot seek to next element");
+			break;
+		}
+	}
+	d_parser->rewind();
+	d_dirValid = d_error.isEmpty();
+	return d_dir;
+}
+
+QVariant MatReader::load(const QByteArray &name)
+{
+	const Directory& dir = readDirectory();
+	if( hasError() )
+		return QVariant();
+	foreach( const Variable& v, dir )
+	{
+		if( v.d_name == name )
+			return load( v );
+	}
+	return QVariant();
+}
+
+QVariant MatReader::load(const Variable & v)
+{
+	d_error.clear();
+	if( v.d_offset < 0 || !d_parser->seek( v.d_offset ) )
+		return error("Cannot seek to variable");
+	return readElement();
+}
+
+class MatReader::ElementTask : public QRunnable
+{
+public:
+	// Dekodiert ein vollstaendiges Element (inkl. Tag) aus d_raw oder, falls d_path gesetzt, ab d_pos aus
+	// einem eigenen QFile; jeder Task hat seinen eigenen Reader mit den Einstellungen des aufrufenden Readers
+	QByteArray d_raw;
+	QString d_path;
+	qint64 d_pos;
+	QVariant* d_res;
+	QString* d_err;
+	QSemaphore* d_pending;
+	Selection* d_sel;
+	quint32 d_limit;
+	bool d_swap;
+	bool d_lazy;
+	bool d_columnar;
+	bool d_preview;
+	bool d_arena;
+	ElementTask():d_pos(0),d_sel(0) {}
+	~ElementTask()
+	{
+		if( d_sel )
+			delete d_sel;
+	}
+	void run()
+	{
+		QBuffer buf( &d_raw );
+		QFile file( d_path );
+		MatReader r;
+		if( d_path.isEmpty() )
+		{
+			buf.open( QIODevice::ReadOnly );
+			r.d_parser->setElementDevice( &buf, d_swap );
+			r.d_src = d_raw;
+		}else if( !file.open( QIODevice::ReadOnly ) || !r.d_parser->setDevice( &file ) ||
+				  !r.d_parser->seek( d_pos ) )
+		{
+			*d_err = "Cannot open variable";
+			d_pending->release();
+			return;
+		}
+		r.setLimit( d_limit );
+		r.setPreview( d_preview );
+		r.d_lazy = d_lazy;
+		r.d_columnar = d_columnar;
+		r.d_sel = d_sel;
+		d_sel = 0;
+		// Arena ist nicht thread-safe, daher eine eigene je Task; die Buffer halten sie am Leben
+		QExplicitlySharedDataPointer<Arena> arena;
+		if( d_arena )
+		{
+			arena = new Arena();
+			r.setArena( arena.data() );
+		}
+		*d_res = r.readElement();
+		*d_err = r.getError();
+		d_raw.clear();
+		d_pending->release();
+	}
+};
+
+QVariantList MatReader::loadAll(int threadCount)
+{
+	const Directory dir = readDirectory();
+	if( hasError() )
+		return QVariantList();
+	QVector<QVariant> res( dir.size() );
+	QVector<QString> err( dir.size() );
+	QThreadPool pool;
+	if( threadCount > 0 )
+		pool.setMaxThreadCount( threadCount );
+	// begrenzt die Zahl der gelesenen, aber noch nicht dekodierten Elemente im Speicher
+	QSemaphore pending( 2 * pool.maxThreadCount() );
+	QIODevice* in = d_parser->getDevice();
+	// Das Device wird nur hier sequentiell gelesen; Inflate und Parsen laufen in den Tasks
+	for( int i = 0; i < dir.size(); i++ )
+	{
+		bool selected;
+		select( d_sel, -1, dir[i].d_name, selected );
+		if( !selected )
+			continue;
+		QFile* file = qobject_cast<QFile*>( in );
+		const bool big = dir[i].d_size > BigElement;
+		if( big && ( dir[i].d_compressed || file == 0 || file->fileName().isEmpty() || d_lazy ) )
+		{
+			// Wird nicht als Ganzes in den Speicher gelesen, sondern hier sequentiell dekodiert
+			res[i] = load( dir[i] );
+			err[i] = d_error;
+			d_error.clear();
+			continue;
+		}
+		pending.acquire();
+		ElementTask* t = new ElementTask();
+		if( big )
+		{
+			t->d_path = file->fileName();
+			t->d_pos = dir[i].d_offset;
+		}else if( !in->seek( dir[i].d_offset ) )
+		{
+			delete t;
+			error("Cannot seek to variable");
+			break;
+		}else
+		{
+			t->d_raw = in->read( dir[i].d_size );
+			if( t->d_raw.size() != dir[i].d_size )
+			{
+				delete t;
+				error("Cannot read variable");
+				break;
+			}
+		}
+		t->d_res = &res[i];
+		t->d_err = &err[i];
+		t->d_pending = &pending;
+		if( d_sel )
+			t->d_sel = d_sel->clone();
+		t->d_limit = getLimit();
+		t->d_swap = d_parser->needsByteSwap();
+		t->d_lazy = d_lazy;
+		t->d_columnar = d_columnar;
+		t->d_preview = isPreview();
+		t->d_arena = getArena() != 0;
+		pool.start( t );
+	}
+	pool.waitForDone();
+	d_parser->rewind();
+	if( hasError() )
+		return QVariantList();
+	QVariantList l;
+	for( int i = 0; i < err.size(); i++ )
+	{
+		if( !err[i].isEmpty() )
+		{
+			d_error = err[i];
+			return QVariantList();
+		}
+		bool selected;
+		select( d_sel, -1, dir[i].d_name, selected );
+		if( selected )
+			l.append( res[i] );
+	}
+	return l;
+}
+
+static inline qint64 _totalCount( const QVector<qint32>& v )
+{
+	qint64 res = 1;
 	foreach( qint32 i, v )
 		res *= i;
 	return res;
 }
 
-static QVariantList _toList( const QByteArray& a, bool _signed, int limit )
+static NumericBuffer _toBuffer( const QVariant& v, bool _signed, quint32 limit )
 {
-	QVariantList res;
-	for( int i = 0; i < a.size() && ( limit == 0 || i < limit ); i++ )
+	if( v.type() == QVariant::ByteArray )
 	{
-		if( _signed )
-			res.append(qint32(qint8(a.at(i))));
-		else
-			res.append(quint32(quint8(a.at(i))));
+		QByteArray a = v.toByteArray();
+		if( limit != 0 && quint32(a.size()) > limit )
+			a.truncate( limit );
+		return NumericBuffer( ( _signed ) ? NumericBuffer::Int8 : NumericBuffer::UInt8, a );
+	}else
+		return v.value<NumericBuffer>();
+}
+
+static bool _convert( const NumericBuffer& from, quint8 type, Arena* arena, NumericBuffer& to )
+{
+	// false, falls das Resultat im Typ der Klasse groesser als NumericBuffer::MaxBytes wuerde
+	to = from.convertTo( type, arena );
+	return to.isValid() || !from.isValid();
+}
+
+static quint8 _typeFromClass( int mxClass )
+{
+	switch( mxClass )
+	{
+	case mxDOUBLE_CLASS:
+		return NumericBuffer::Double;
+	case mxSINGLE_CLASS:
+		return NumericBuffer::Single;
+	case mxINT8_CLASS:
+		return NumericBuffer::Int8;
+	case mxUINT8_CLASS:
+		return NumericBuffer::UInt8;
+	case mxINT16_CLASS:
+		return NumericBuffer::Int16;
+	case mxUINT16_CLASS:
+		return NumericBuffer::UInt16;
+	case mxINT32_CLASS:
+		return NumericBuffer::Int32;
+	case mxUINT32_CLASS:
+		return NumericBuffer::UInt32;
+	case mxINT64_CLASS:
+		return NumericBuffer::Int64;
+	case mxUINT64_CLASS:
+		return NumericBuffer::UInt64;
+	default:
+		return NumericBuffer::Invalid;
+	}
+}
+
+ArrayCursor MatReader::openArray(const QByteArray &name)
+{
+	const Directory& dir = readDirectory();
+	if( hasError() )
+		return ArrayCursor();
+	foreach( const Variable& v, dir )
+	{
+		if( v.d_name == name )
+			return openArray( v );
+	}
+	error("Variable not found");
+	return ArrayCursor();
+}
+
+ArrayCursor MatReader::openArray(const Variable & v)
+{
+	d_error.clear();
+	if( v.d_offset < 0 || !d_parser->seek( v.d_offset ) )
+	{
+		error("Cannot seek to variable");
+		return ArrayCursor();
+	}
+	if( d_parser->nextToken().d_type != MatParser::BeginMatrix )
+	{
+		error("Variable is not a matrix");
+		return ArrayCursor();
+	}
+	ArrayCursor c;
+	quint32 f;
+	quint32 nzmax;
+	if( !readHeader( f, nzmax, c.d_dims, c.d_name ) )
+		return ArrayCursor();
+	c.d_type = _typeFromClass( f & 0xff );
+	c.d_complex = f & 0x800;
+	if( c.d_type == NumericBuffer::Invalid || c.d_dims.size() < 2 )
+	{
+		error("Variable is not a numeric array");
+		return ArrayCursor();
+	}
+	MatLexer::DataElement e = d_parser->nextDataElement();
+	if( e.d_end || e.d_error || NumericBuffer::elementSize( e.d_type ) == 0 )
+	{
+		error("Invalid array real part");
+		return ArrayCursor();
+	}
+	c.d_in = e.d_stream;
+	c.d_miType = e.d_type;
+	c.d_count = c.d_in->bytesAvailable() / NumericBuffer::elementSize( e.d_type );
+	c.d_swap = d_parser->needsByteSwap();
+	c.d_level = new ArrayCursor::Level();
+	c.d_level->d_parser = d_parser;
+	c.d_level->d_matrix = d_parser->getMatrixStream();
+	c.d_level->d_in = c.d_in;
+	return c;
+}
+
+void ArrayCursor::Level::leave()
+{
+	if( d_parser == 0 )
+		return;
+	d_in->discard();
+	d_parser->leaveMatrix( d_matrix.data() );
+	d_parser = 0;
+}
+
+NumericBuffer ArrayCursor::next(qint32 maxCount)
+{
+	if( atEnd() || d_in.data() == 0 || maxCount <= 0 )
+		return NumericBuffer();
+	// gelesen wird im gespeicherten Typ, geliefert im Typ der Klasse; beide Buffer muessen MaxBytes einhalten
+	const qint64 fit = NumericBuffer::MaxBytes /
+			qMax( NumericBuffer::elementSize( d_miType ), NumericBuffer::elementSize( d_type ) );
+	const qint32 count = qMin( qMin( qint64(maxCount), fit ), d_count - d_pos );
+	NumericBuffer raw( d_miType, count );
+	const qint64 len = raw.getBytes().size();
+	char* data = raw.getRawData();
+	if( MatLexer::readBlock( d_in.data(), data, len ) != len )
+	{
+		qWarning() << "ArrayCursor: cannot read data";
+		d_pos = d_count;
+		return NumericBuffer();
+	}
+	if( d_swap )
+		MatLexer::swapBuffer( data, NumericBuffer::elementSize( d_miType ), count );
+	d_pos += count;
+	if( atEnd() && !d_in->atEnd() )
+		MatLexer::skip( d_in.data(), d_in->bytesAvailable() );
+	if( atEnd() && d_level.data() )
+		d_level->leave();
+	return raw.convertTo( d_type );
+}
+
+static bool _readSlabPart( QIODevice* in, quint8 miType, bool swap, const QVector<qint32>& dims,
+						   const QVector<qint32>& off, const QVector<qint32>& cnt, const QVector<qint32>& str,
+						   NumericBuffer& out )
+{
+	// Column-major: Dimension 0 laeuft am schnellsten; alle Positionen sind aufsteigend, es wird nur vorwaerts gesprungen
+	const int esize = NumericBuffer::elementSize( miType );
+	const int k = dims.size();
+	QVector<qint64> lin( k );
+	qint64 f = 1;
+	qint64 total = 1;
+	for( int j = 0; j < k; j++ )
+	{
+		lin[j] = f;
+		f *= dims[j];
+		total *= cnt[j];
+	}
+	if( total > NumericBuffer::MaxBytes / esize )
+		return false;
+	NumericBuffer raw( miType, total );
+	if( total == 0 )
+	{
+		out = raw;
+		return true;
+	}
+	char* dst = raw.getRawData();
+	QVector<qint32> idx( k, 0 );
+	qint64 cur = 0;
+	while( true )
+	{
+		qint64 start = off[0];
+		for( int j = 1; j < k; j++ )
+			start += ( off[j] + qint64(idx[j]) * str[j] ) * lin[j];
+		const qint32 run = ( str[0] == 1 ) ? cnt[0] : 1;
+		for( qint32 i = 0; i < cnt[0]; i += run )
+		{
+			const qint64 pos = start + qint64(i) * str[0];
+			const qint64 gap = ( pos - cur ) * esize;
+			if( MatLexer::skip( in, gap ) != gap )
+				return false;
+			const qint64 len = qint64(run) * esize;
+			if( MatLexer::readBlock( in, dst, len ) != len )
+				return false;
+			dst += len;
+			cur = pos + run;
+		}
+		int j = 1;
+		for( ; j < k; j++ )
+		{
+			if( ++idx[j] < cnt[j] )
+				break;
+			idx[j] = 0;
+		}
+		if( j >= k )
+			break;
 	}
+	if( swap )
+		MatLexer::swapBuffer( raw.getRawData(), esize, total );
+	out = raw;
+	return true;
+}
+
+NumericArray MatReader::readSlab(const QByteArray &name, const QVector<qint32> &offsets,
+								 const QVector<qint32> &counts, const QVector<qint32> &_strides)
+{
+	NumericArray res;
+	const Directory& dir = readDirectory();
+	if( hasError() )
+		return res;
+	Variable var;
+	foreach( const Variable& v, dir )
+	{
+		if( v.d_name == name )
+		{
+			var = v;
+			break;
+		}
+	}
+	if( var.d_offset < 0 )
+	{
+		error("Variable not found");
+		return res;
+	}
+	const QVector<qint32> strides = ( _strides.isEmpty() ) ? QVector<qint32>( offsets.size(), 1 ) : _strides;
+	const QVector<qint32>& dims = var.d_dims;
+	if( offsets.size() != dims.size() || counts.size() != dims.size() || strides.size() != dims.size() )
+	{
+		error("Slab does not match array dimensions");
+		return res;
+	}
+	for( int j = 0; j < dims.size(); j++ )
+	{
+		if( offsets[j] < 0 || counts[j] < 0 || strides[j] < 1 ||
+				( counts[j] > 0 && offsets[j] + qint64( counts[j] - 1 ) * strides[j] >= dims[j] ) )
+		{
+			error("Slab out of range");
+			return res;
+		}
+	}
+	ArrayCursor c = openArray( var );
+	if( !c.isValid() )
+		return res;
+	if( c.d_count != _totalCount( dims ) )
+	{
+		error("Invalid array real part");
+		return res;
+	}
+	if( _totalCount( counts ) > NumericBuffer::MaxBytes / NumericBuffer::elementSize( c.d_miType ) )
+	{
+		error("Slab too large, use openArray");
+		return res;
+	}
+	NumericBuffer real;
+	if( !_readSlabPart( c.d_in.data(), c.d_miType, c.d_swap, dims, offsets, counts, strides, real ) )
+	{
+		error("Cannot read slab");
+		return res;
+	}
+	NumericBuffer img;
+	if( c.d_complex )
+	{
+		// Der Imaginaerteil folgt direkt auf den Realteil
+		MatLexer::skip( c.d_in.data(), c.d_in->bytesAvailable() );
+		MatLexer::DataElement e = d_parser->nextDataElement();
+		if( e.d_end || e.d_error || NumericBuffer::elementSize( e.d_type ) == 0 ||
+				!_readSlabPart( e.d_stream.data(), e.d_type, c.d_swap, dims, offsets, counts, strides, img ) )
+		{
+			error("Cannot read slab");
+			return res;
+		}
+		e.d_stream->discard();
+	}else
+		c.d_in->discard();
+	d_parser->seek( var.d_offset + var.d_size );
+	if( !_convert( real, c.d_type, 0, res.d_real ) || !_convert( img, c.d_type, 0, res.d_img ) )
+	{
+		error("Array too large for its class");
+		return NumericArray();
+	}
+	res.d_valid = true;
+	res.d_name = name;
+	res.d_dims = counts;
 	return res;
 }
 
@@ -124,38 +761,176 @@ static QList<QByteArray> _split( const QByteArray& str, int chunkLen )
 	return res;
 }
 
-QVariant MatReader::readMatrix()
+bool MatReader::visit(MatVisitor * v)
+{
+	Q_ASSERT( v != 0 );
+	d_error.clear();
+	return visitLevel( v );
+}
+
+bool MatReader::visitLevel(MatVisitor * v)
+{
+	// Elemente der aktuellen Ebene bis zu deren Ende; Werte werden nicht als Token gelesen
+	enum { miMATRIX = 14 };
+	quint8 part = 0;
+	while( true )
+	{
+		MatLexer::DataElement e = d_parser->nextDataElement();
+		if( e.d_error )
+			return error("Lexer Error").toBool();
+		if( e.d_end )
+			return true;
+		if( e.d_type == miMATRIX )
+		{
+			d_parser->enterMatrix( e );
+			if( !visitMatrix( v ) )
+				return false;
+		}else if( !visitData( v, part++, e ) )
+			return false;
+	}
+}
+
+bool MatReader::visitData(MatVisitor * v, quint8 part, const MatLexer::DataElement & e)
 {
-	const int limit = d_parser->getLimit();
+	MatLexer::InStream* in = e.d_stream.data();
+	const quint8 len = NumericBuffer::elementSize( e.d_type );
+	if( len == 0 )
+	{
+		// Strings sind klein und werden ganz gelesen
+		const MatParser::Token t = d_parser->readValue( in->readAll(), e.d_type );
+		if( t.d_type != MatParser::Value || t.d_value.type() != QVariant::String )
+			return error("Invalid value").toBool();
+		v->chars( t.d_value.toString() );
+		return true;
+	}
+	// Numerische Daten stueckweise ueber einen Cursor, damit der Speicher nicht mit dem Element waechst;
+	// die mi Typen entsprechen NumericBuffer::Type
+	ArrayCursor c;
+	c.d_in = e.d_stream;
+	c.d_miType = e.d_type;
+	c.d_type = e.d_type;
+	c.d_swap = d_parser->needsByteSwap();
+	c.d_count = in->bytesAvailable() / len;
+	const quint32 limit = d_parser->getLimit();
+	if( limit != 0 && c.d_count > limit )
+		c.d_count = limit;
+	if( c.d_count == 0 )
+		v->numericData( part, e.d_type, 0, 0 );
+	while( !c.atEnd() )
+	{
+		const NumericBuffer b = c.next();
+		if( !b.isValid() )
+			return error("Cannot read data").toBool();
+		v->numericData( part, b.getType(), b.getBytes().constData(), b.size() );
+	}
+	MatLexer::skip( in, in->bytesAvailable() ); // Rest nach dem Limit
+	return true;
+}
 
+bool MatReader::visitMatrix(MatVisitor * v)
+{
+	// BeginMatrix ist bereits gelesen; liest bis und mit EndMatrix
 	MatParser::Token t = d_parser->peekToken();
-	if( t.d_type == MatParser::EndMatrix )
-		return QVariant(); // Das kommt tatschlich vor
-	t = d_parser->nextToken(); // eat
-	QVariantList l = t.d_value.toList();
+	if( t.d_type != MatParser::EndMatrix )
+	{
+		quint32 f;
+		quint32 nzmax;
+		QVector<qint32> dims;
+		QByteArray name;
+		if( !readHeader( f, nzmax, dims, name ) )
+			return false;
+		const int type = f & 0xff;
+		v->beginMatrix( type, f & 0xff00, dims, name );
+		if( type == mxOBJECT_CLASS )
+		{
+			t = d_parser->nextToken();
+			if( t.d_type != MatParser::Value || t.d_value.type() != QVariant::ByteArray )
+				return error("Invalid class format").toBool();
+			v->className( t.d_value.toByteArray() );
+		}
+		if( type == mxSTRUCT_CLASS || type == mxOBJECT_CLASS )
+		{
+			t = d_parser->nextToken();
+			if( t.d_type != MatParser::Value || t.d_value.value<NumericBuffer>().size() != 1 )
+				return error("Invalid struct format").toBool();
+			const qint32 nameLength = t.d_value.value<NumericBuffer>().getValue(0).toInt();
+			t = d_parser->nextToken();
+			if( t.d_type != MatParser::Value || t.d_value.type() != QVariant::ByteArray )
+				return error("Invalid struct format").toBool();
+			v->fieldNames( _split( t.d_value.toByteArray(), nameLength ) );
+		}
+		// Rest der Ebene generisch: Werte und eingebettete Matrizen in der Reihenfolge im File
+		if( !visitLevel( v ) )
+			return false;
+		v->endMatrix();
+	}
+	t = d_parser->nextToken();
+	if( t.d_type != MatParser::EndMatrix )
+		return error("Invalid matrix end").toBool();
+	return true;
+}
+
+bool MatReader::readHeader(quint32 &f, quint32& nzmax, QVector<qint32> &dims, QByteArray &name)
+{
+	MatParser::Token t = d_parser->nextToken();
+	NumericBuffer l = t.d_value.value<NumericBuffer>();
 	if( t.d_type != MatParser::Value || l.size() != 2 )
-		return error("Invalid array flags");
-	const quint32 f = l.first().toUInt();
-	const bool logical = f & 0x200;
-	const bool global = f & 0x400;
-	const bool complex = f & 0x800;
+		return error("Invalid array flags").toBool();
+	f = l.getValue(0).toUInt();
 	const int type = f & 0xff;
-	const quint32 nzmax = l.last().toUInt();
-	Q_UNUSED(nzmax);
+	nzmax = l.getValue(1).toUInt();
 
 	t = d_parser->nextToken();
-	l = t.d_value.toList();
+	l = t.d_value.value<NumericBuffer>();
 	if( type <= 15 && ( t.d_type != MatParser::Value || l.isEmpty() ) )
-		return error("Invalid array dimensions");
-	QVector<qint32> dims( l.size() );
+		return error("Invalid array dimensions").toBool();
+	dims.resize( l.size() );
 	for( int i = 0; i < dims.size(); i++ )
-		dims[i] = l[i].toInt();
-	const qint32 totalCount = _totalCount( dims );
+		dims[i] = l.getValue(i).toInt();
 
 	t = d_parser->nextToken();
 	if( t.d_type != MatParser::Value || t.d_value.type() != QVariant::ByteArray )
-		return error("Invalid array name");
-	const QByteArray name = t.d_value.toByteArray();
+		return error("Invalid array name").toBool();
+	name = t.d_value.toByteArray();
+	return true;
+}
+
+QVariant MatReader::readMatrix()
+{
+	MatParser::Token t = d_parser->peekToken();
+	if( t.d_type == MatParser::EndMatrix )
+		return QVariant(); // Das kommt tatschlich vor
+	quint32 f;
+	quint32 nzmax;
+	QVector<qint32> dims;
+	QByteArray name;
+	if( !readHeader( f, nzmax, dims, name ) )
+		return QVariant();
+	if( d_cur != 0 && d_cur == d_sel )
+	{
+		// oberste Ebene; die Variable wird anhand des Namens gewaehlt
+		bool selected;
+		d_cur = select( d_sel, -1, name, selected );
+		if( !selected )
+		{
+			d_parser->skipLevel();
+			return QVariant();
+		}
+	}
+	return readBody( f, nzmax, dims, name );
+}
+
+QVariant MatReader::readBody(quint32 f, quint32 nzmax, const QVector<qint32> &dims, const QByteArray &name)
+{
+	// Rest der Matrix nach dem Header
+	const quint32 limit = d_parser->getLimit();
+	MatParser::Token t;
+	const bool logical = f & 0x200;
+	const bool global = f & 0x400;
+	const bool complex = f & 0x800;
+	const int type = f & 0xff;
+	const qint64 totalCount = _totalCount( dims );
+	NumericBuffer l;
 
 	switch( type )
 	{
@@ -173,56 +948,77 @@ QVariant MatReader::readMatrix()
 			return error("At least two dimensions required");
 		else
 		{
+			d_parser->setTail( d_tail && !complex );
 			t = d_parser->nextToken();
-			l.clear();
-			if( t.d_value.type() == QVariant::ByteArray )
-				l = _toList( t.d_value.toByteArray(), type != mxUINT8_CLASS, limit );
-			else if( t.d_value.type() == QVariant::List )
-				l = t.d_value.toList();
-			else
-				l << t.d_value;
+			l = _toBuffer( t.d_value, type != mxUINT8_CLASS, limit );
 			if( t.d_type != MatParser::Value || ( limit == 0 && l.size() != totalCount ) )
 				return error("Invalid array real part");
+			// MATLAB speichert oft in einem kleineren Typ als die Klasse; d_real hat immer den Typ der Klasse
+			const quint8 elemType = _typeFromClass( type );
 			NumericArray a;
 			a.d_valid = true;
 			a.d_name = name;
 			a.d_logical = logical;
 			a.d_global = global;
 			a.d_dims = dims;
-			a.d_real = l;
+			if( !_convert( l, elemType, d_parser->getArena(), a.d_real ) )
+				return error("Array too large for its class");
 			if( complex )
 			{
+				d_parser->setTail( d_tail );
 				t = d_parser->nextToken();
-				l.clear();
-				if( t.d_value.type() == QVariant::ByteArray )
-					l = _toList( t.d_value.toByteArray(), type != mxUINT8_CLASS, limit );
-				else if( t.d_value.type() == QVariant::List )
-					l = t.d_value.toList();
-				else
-					l << t.d_value;
+				l = _toBuffer( t.d_value, type != mxUINT8_CLASS, limit );
 				if( t.d_type != MatParser::Value || ( limit == 0 && l.size() != totalCount ) )
 					return error("Invalid array complex part");
-				a.d_img = l;
+				if( !_convert( l, elemType, d_parser->getArena(), a.d_img ) )
+					return error("Array too large for its class");
 			}
 			return QVariant::fromValue(a);
 		}
 		break;
 	case mxSPARSE_CLASS:
-		if( dims.size() < 0 || dims.size() > 2 )
+		if( dims.size() != 2 )
 			return error("Invalid sparse array dimensions");
 		else
 		{
-			t = d_parser->nextToken(); // Row Index (ir) miINT32 nzmax * sizeOfDataType (The nzmax value is stored in Array Flags.)
-			t = d_parser->nextToken(); // Column Index (jc) miINT32 (N+1) * sizeof(int32) where N is the second element of the Dimensions array subelement.
-			t = d_parser->nextToken(); // Real part (pr)
-			if( complex )
-				t = d_parser->nextToken(); // Imaginary part (pi)
-			qWarning() << "## Sparse arrays not yet supported";
 			SparseArray a;
 			a.d_valid = true;
 			a.d_name = name;
 			a.d_logical = logical;
 			a.d_global = global;
+			a.d_dims = dims;
+			a.d_nzmax = nzmax;
+			t = d_parser->nextToken(); // Row Index (ir) miINT32 nzmax * sizeOfDataType (The nzmax value is stored in Array Flags.)
+			if( t.d_type != MatParser::Value )
+				return error("Invalid sparse row index");
+			if( !_convert( _toBuffer( t.d_value, true, limit ), NumericBuffer::Int32, d_parser->getArena(), a.d_ir ) )
+				return error("Array too large for its class");
+			t = d_parser->nextToken(); // Column Index (jc) miINT32 (N+1) * sizeof(int32) where N is the second element of the Dimensions array subelement.
+			if( t.d_type != MatParser::Value )
+				return error("Invalid sparse column index");
+			if( !_convert( _toBuffer( t.d_value, true, limit ), NumericBuffer::Int32, d_parser->getArena(), a.d_jc ) )
+				return error("Array too large for its class");
+			if( limit == 0 && a.d_jc.size() != dims[1] + 1 )
+				return error("Invalid sparse column index");
+			d_parser->setTail( d_tail && !complex );
+			t = d_parser->nextToken(); // Real part (pr)
+			if( t.d_type != MatParser::Value )
+				return error("Invalid sparse real part");
+			// Sparse Arrays sind double oder logical
+			const quint8 elemType = ( logical ) ? quint8(NumericBuffer::UInt8) : quint8(NumericBuffer::Double);
+			if( !_convert( _toBuffer( t.d_value, type != mxUINT8_CLASS, limit ), elemType, d_parser->getArena(), a.d_real ) )
+				return error("Array too large for its class");
+			if( limit == 0 && a.d_real.size() < a.getNonZeroCount() )
+				return error("Invalid sparse real part");
+			if( complex )
+			{
+				d_parser->setTail( d_tail );
+				t = d_parser->nextToken(); // Imaginary part (pi)
+				if( t.d_type != MatParser::Value )
+					return error("Invalid sparse complex part");
+				if( !_convert( _toBuffer( t.d_value, type != mxUINT8_CLASS, limit ), elemType, d_parser->getArena(), a.d_img ) )
+					return error("Array too large for its class");
+			}
 			return QVariant::fromValue(a);
 		}
 		break;
@@ -240,24 +1036,44 @@ QVariant MatReader::readMatrix()
 			t = d_parser->peekToken();
 			if( t.d_type == MatParser::BeginMatrix )
 			{
+				const Selection* cur = d_cur;
+				const bool tail = d_tail;
 				int i = 0;
 				do
 				{
-					t = d_parser->nextToken(); // eat
-					a.d_cells.append( readMatrix() );
-					if( !d_error.isEmpty() )
-						return QVariant();
-					t = d_parser->nextToken();
-					if( t.d_type != MatParser::EndMatrix )
-						return error("Invalid cell end");
+					const bool last = tail && ( i + 1 >= totalCount || ( limit != 0 && quint32(i + 1) >= limit ) );
+					d_tail = last;
+					bool selected;
+					d_cur = select( cur, i, QByteArray(), selected );
+					if( !selected )
+					{
+						a.d_cells.append( QVariant() );
+						if( !skipMatrix() )
+							return QVariant();
+					}else if( d_lazy && d_cur == 0 )
+					{
+						a.d_cells.append( readLazy() );
+						if( !d_error.isEmpty() )
+							return QVariant();
+					}else
+					{
+						t = d_parser->nextToken(); // eat
+						a.d_cells.append( readMatrix() );
+						if( !d_error.isEmpty() )
+							return QVariant();
+						t = d_parser->nextToken();
+						if( t.d_type != MatParser::EndMatrix )
+							return error("Invalid cell end");
+					}
 					i++;
-					if( limit != 0 && i >= limit )
+					if( limit != 0 && quint32(i) >= limit )
 					{
-						d_parser->skipLevel();
+						skipRest( last );
 						break;
 					}
 					t = d_parser->peekToken();
 				}while( t.d_type == MatParser::BeginMatrix );
+				d_tail = tail;
 			}
 			return QVariant::fromValue(a);
 		}
@@ -279,9 +1095,9 @@ QVariant MatReader::readMatrix()
 	case mxSTRUCT_CLASS:
 		{
 			t = d_parser->nextToken();
-			if( t.d_type != MatParser::Value || t.d_value.type() != QVariant::Int )
+			if( t.d_type != MatParser::Value || t.d_value.value<NumericBuffer>().size() != 1 )
 				return error("Invalid struct format");
-			const qint32 nameLength = t.d_value.toInt();
+			const qint32 nameLength = t.d_value.value<NumericBuffer>().getValue(0).toInt();
 			t = d_parser->nextToken();
 			if( t.d_type != MatParser::Value || t.d_value.type() != QVariant::ByteArray )
 				return error("Invalid struct format");
@@ -292,7 +1108,7 @@ QVariant MatReader::readMatrix()
 			s.d_logical = logical;
 			s.d_global = global;
 
-			if( !readFields( s, names ) )
+			if( !readFields( s, names, totalCount ) )
 				return QVariant();
 			return QVariant::fromValue( s );
 		}
@@ -311,7 +1127,10 @@ QVariant MatReader::readMatrix()
 				t = d_parser->nextToken();
 				if( t.d_type != MatParser::Value )
 					return error("Invalid type 17 format");
-				s.d_value = t.d_value;
+				if( t.d_value.canConvert<NumericBuffer>() )
+					s.d_value = t.d_value.value<NumericBuffer>().toVariant();
+				else
+					s.d_value = t.d_value;
 			}
 			t = d_parser->nextToken();
 			if( t.d_type != MatParser::BeginMatrix )
@@ -332,9 +1151,9 @@ QVariant MatReader::readMatrix()
 				return error("Invalid class format");
 			const QByteArray className = t.d_value.toByteArray();
 			t = d_parser->nextToken();
-			if( t.d_type != MatParser::Value || t.d_value.type() != QVariant::Int )
+			if( t.d_type != MatParser::Value || t.d_value.value<NumericBuffer>().size() != 1 )
 				return error("Invalid class format");
-			const qint32 nameLength = t.d_value.toInt();
+			const qint32 nameLength = t.d_value.value<NumericBuffer>().getValue(0).toInt();
 			t = d_parser->nextToken();
 			if( t.d_type != MatParser::Value || t.d_value.type() != QVariant::ByteArray )
 				return error("Invalid class format");
@@ -345,7 +1164,7 @@ QVariant MatReader::readMatrix()
 			s.d_className = className;
 			s.d_logical = logical;
 			s.d_global = global;
-			if( !readFields( s, names ) )
+			if( !readFields( s, names, totalCount ) )
 				return QVariant();
 			return QVariant::fromValue( s );
 		}
@@ -361,55 +1180,310 @@ QVariant MatReader::error(const char * msg)
 	return QVariant();
 }
 
-bool MatReader::readFields(Structure & s, const QList<QByteArray>& names)
+static NumericArray _scalar( const NumericBuffer& col, qint32 i )
+{
+	const int len = NumericBuffer::elementSize( col.getType() );
+	NumericArray a;
+	a.d_valid = true;
+	a.d_dims << 1 << 1;
+	a.d_real = NumericBuffer( col.getType(), col.getBytes().mid( i * len, len ) );
+	return a;
+}
+
+static bool _appendToColumn( Structure& s, int f, const QVariant& v )
+{
+	// Solange alle Zeilen eines Felds reelle Skalare desselben Typs sind, landen sie in einer Spalte;
+	// sonst wird die Spalte nach d_fields ausgepackt und das Feld dort weitergefuehrt.
+	if( f >= s.d_columns.size() || s.d_fields.contains( s.d_names[f] ) )
+		return false;
+	NumericBuffer& col = s.d_columns[f];
+	if( v.canConvert<NumericArray>() )
+	{
+		const NumericArray a = v.value<NumericArray>();
+		if( a.d_real.size() == 1 && a.d_img.isEmpty() && !a.d_logical && a.d_name.isEmpty() &&
+				( !col.isValid() || col.getType() == a.d_real.getType() ) )
+		{
+			if( !col.isValid() )
+				col = NumericBuffer( a.d_real.getType(), 0 );
+			col.append( a.d_real );
+			return true;
+		}
+	}
+	QVariantList& l = s.d_fields[ s.d_names[f] ];
+	for( qint32 i = 0; i < col.size(); i++ )
+		l.append( QVariant::fromValue( _scalar( col, i ) ) );
+	col = NumericBuffer();
+	return false;
+}
+
+void MatReader::skipRest(bool last)
 {
+	// Rest der Ebene nach dem Limit; abbrechen nur, wenn danach von der Variable nichts mehr benoetigt wird
+	if( !last || !d_parser->truncate() )
+		d_parser->skipLevel();
+}
+
+bool MatReader::readColumnValue(Structure & s, int f, QVariant & v)
+{
+	// Reelle Skalare kommen ohne NumericArray und QVariant direkt in die Spalte; alles andere wie readMatrix
+	if( f >= s.d_columns.size() || s.d_fields.contains( s.d_names[f] ) ||
+			d_parser->peekToken().d_type == MatParser::EndMatrix )
+	{
+		v = readMatrix();
+		return false;
+	}
+	quint32 flags;
+	quint32 nzmax;
+	QVector<qint32> dims;
+	QByteArray name;
+	if( !readHeader( flags, nzmax, dims, name ) )
+		return false;
+	const int type = flags & 0xff;
+	const quint8 elemType = _typeFromClass( type );
+	NumericBuffer& col = s.d_columns[f];
+	if( elemType == NumericBuffer::Invalid || ( flags & 0xa00 ) != 0 || !name.isEmpty() || dims.size() < 2 ||
+			_totalCount( dims ) != 1 || ( col.isValid() && col.getType() != elemType ) )
+	{
+		v = readBody( flags, nzmax, dims, name );
+		return false;
+	}
+	d_parser->setTail( d_tail );
+	const MatParser::Token t = d_parser->nextToken();
+	const NumericBuffer l = _toBuffer( t.d_value, type != mxUINT8_CLASS, 0 );
+	if( t.d_type != MatParser::Value || l.size() != 1 )
+		return error("Invalid array real part").toBool();
+	if( !col.isValid() )
+		col = NumericBuffer( elemType, 0 );
+	col.append( l.convertTo( elemType ) );
+	return true;
+}
+
+bool MatReader::readFields(Structure & s, const QList<QByteArray>& names, qint64 count)
+{
+	s.d_names = names;
+	s.d_index.clear();
+	for( int i = 0; i < names.size(); i++ )
+		s.d_index.insert( names[i], i );
+	const Selection* cur = d_cur;
+	if( d_columnar && cur == 0 )
+		s.d_columns.resize( names.size() );
 	int n = 0;
-	const quint32 limit = d_parser->getLimit() * names.size(); // in jedem Feld max Limit
+	const qint64 limit = qint64(d_parser->getLimit()) * names.size(); // in jedem Feld max Limit
+	const qint64 total = count * names.size();
+	const bool tail = d_tail;
+	bool last = false;
 	MatParser::Token t = d_parser->peekToken();
 	if( t.d_type == MatParser::BeginMatrix )
 	{
 		do
 		{
-			t = d_parser->nextToken(); // eat
-			const QVariant v = readMatrix();
-			if( !d_error.isEmpty() )
-				return false;
-			s.d_fields[ names[ n % names.size() ] ].append( v );
-			t = d_parser->nextToken();
-			if( t.d_type != MatParser::EndMatrix )
-				return error("Invalid field end").toBool();
+			last = tail && ( n + 1 >= total || ( limit != 0 && n + 1 >= limit ) );
+			d_tail = last;
+			bool selected;
+			d_cur = select( cur, n / names.size(), names[ n % names.size() ], selected );
+			if( !selected )
+			{
+				s.d_fields[ names[ n % names.size() ] ].append( QVariant() );
+				if( !skipMatrix() )
+					return false;
+			}else if( d_lazy && d_cur == 0 )
+			{
+				const QVariant v = readLazy();
+				if( !d_error.isEmpty() )
+					return false;
+				s.d_fields[ names[ n % names.size() ] ].append( v );
+			}else
+			{
+				t = d_parser->nextToken(); // eat
+				const int f = n % names.size();
+				QVariant v;
+				bool inColumn = false;
+				if( d_columnar )
+					inColumn = readColumnValue( s, f, v );
+				else
+					v = readMatrix();
+				if( !d_error.isEmpty() )
+					return false;
+				if( !inColumn && ( !d_columnar || !_appendToColumn( s, f, v ) ) )
+					s.d_fields[ names[ f ] ].append( v );
+				t = d_parser->nextToken();
+				if( t.d_type != MatParser::EndMatrix )
+					return error("Invalid field end").toBool();
+			}
 			n++;
-			if( limit != 0 && quint32(n) >= limit )
+			if( limit != 0 && n >= limit )
 			{
-				d_parser->skipLevel();
+				skipRest( last );
 				break;
 			}
 			t = d_parser->peekToken();
 		}while( t.d_type == MatParser::BeginMatrix );
+		d_tail = tail;
 	}
-	if( n != names.size() && n % names.size() != 0 )
+	if( !names.isEmpty() && n != names.size() && n % names.size() != 0 )
 		return error("Fields and names not consistent").toBool();
+	if( d_columnar && d_lazy && cur == 0 )
+		lazyToColumns( s );
 	return true;
 }
 
+void MatReader::lazyToColumns(Structure & s)
+{
+	// Felder, deren Zeilen alle nicht groesser als ein Skalar sind, werden gleich dekodiert und wie
+	// ohne Lazy in eine Spalte gepackt; groessere Felder bleiben Platzhalter.
+	for( int f = 0; f < s.d_names.size(); f++ )
+	{
+		const QVariantList l = s.d_fields.value( s.d_names[f] );
+		bool small = !l.isEmpty();
+		for( int i = 0; i < l.size() && small; i++ )
+			small = l[i].userType() == qMetaTypeId<LazyMatrix>() &&
+					l[i].value<LazyMatrix>().d->d_len <= LazyScalarLen;
+		if( !small )
+			continue;
+		s.d_fields.remove( s.d_names[f] );
+		for( int i = 0; i < l.size(); i++ )
+		{
+			const QVariant v = LazyMatrix::resolve( l[i] );
+			if( !_appendToColumn( s, f, v ) )
+				s.d_fields[ s.d_names[f] ].append( v );
+		}
+	}
+}
+
+bool MatReader::skipMatrix()
+{
+	// ueberspringt die naechste eingebettete Matrix ohne sie zu dekodieren
+	MatParser::Token t = d_parser->nextToken();
+	if( t.d_type != MatParser::BeginMatrix )
+		return error("Invalid matrix start").toBool();
+	d_parser->skipLevel();
+	t = d_parser->nextToken();
+	if( t.d_type != MatParser::EndMatrix )
+		return error("Invalid matrix end").toBool();
+	return true;
+}
+
+QVariant MatReader::readLazy()
+{
+	LazyMatrix m;
+	m.d = new LazyMatrix::Data();
+	QByteArray raw;
+	if( !d_parser->captureMatrix( m.d->d_pos, m.d->d_len, raw ) )
+		return error("Invalid lazy matrix");
+	if( m.d->d_pos < 0 )
+	{
+		// z.B. innerhalb von miCOMPRESSED; nur die Bytes werden behalten, dekodiert wird spaeter
+		m.d->d_src = raw;
+		m.d->d_pos = 0;
+	}else if( !d_src.isEmpty() )
+		m.d->d_src = d_src;
+	else
+		m.d->d_dev = d_parser->getDevice();
+	m.d->d_swap = d_parser->needsByteSwap();
+	m.d->d_limit = d_parser->getLimit();
+	m.d->d_arena = d_parser->getArena();
+	m.d->d_preview = d_parser->isPreview();
+	m.d->d_columnar = d_columnar;
+	return QVariant::fromValue( m );
+}
+
+QVariant MatReader::decode(const LazyMatrix & m)
+{
+	LazyMatrix::Data* d = m.d.data();
+	QByteArray bytes;
+	if( d->d_dev.isNull() )
+		bytes = d->d_src.mid( d->d_pos, d->d_len );
+	else
+	{
+		QIODevice* dev = d->d_dev;
+		const qint64 old = dev->pos();
+		if( dev->seek( d->d_pos ) )
+			bytes = dev->read( d->d_len );
+		dev->seek( old );
+	}
+	if( bytes.size() != d->d_len )
+	{
+		qWarning() << "LazyMatrix: cannot read matrix data";
+		return QVariant();
+	}
+	QBuffer buf( &bytes );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	r.d_parser->setElementDevice( &buf, d->d_swap );
+	r.setLimit( d->d_limit );
+	r.setArena( d->d_arena.data() );
+	r.setPreview( d->d_preview );
+	r.d_lazy = true;
+	r.d_columnar = d->d_columnar;
+	r.d_src = bytes;
+	const QVariant v = r.readMatrix();
+	if( r.hasError() )
+	{
+		qWarning() << "LazyMatrix:" << r.getError();
+		return QVariant();
+	}
+	return v;
+}
+
+QVariant LazyMatrix::getValue() const
+{
+	if( d.data() == 0 )
+		return QVariant();
+	if( !d->d_done )
+	{
+		d->d_cache = MatReader::decode( *this );
+		d->d_done = true;
+		d->d_src.clear();
+		d->d_dev = 0;
+		d->d_arena = 0;
+	}
+	return d->d_cache;
+}
+
+QVariant LazyMatrix::resolve(const QVariant & v)
+{
+	if( v.userType() == qMetaTypeId<LazyMatrix>() )
+		return v.value<LazyMatrix>().getValue();
+	else
+		return v;
+}
+
 QString Structure::getString(const QByteArray &field) const
 {
-	QVariantList l = d_fields.value(field);
-	if( l.isEmpty() )
-		return QString();
-	else if( l.first().canConvert<String>() )
-		return l.first().value<String>().d_str;
+	const QVariant v = getValue(field);
+	if( v.canConvert<String>() )
+		return v.value<String>().d_str;
 	else
-		return l.first().toString();
+		return v.toString();
 }
 
 QVariant Structure::getValue(const QByteArray &field) const
 {
 	QVariantList l = d_fields.value(field);
-	if( l.isEmpty() )
+	if( !l.isEmpty() )
+		return LazyMatrix::resolve( l.first() );
+	const NumericBuffer col = getColumn( getFieldIndex( field ) );
+	if( !col.isEmpty() )
+		return QVariant::fromValue( _scalar( col, 0 ) );
+	else
 		return QVariant();
+}
+
+int Structure::getFieldIndex(const QByteArray &field) const
+{
+	// d_index fehlt bei selbst zusammengestellten Structures
+	QHash<QByteArray,int>::const_iterator i = d_index.find( field );
+	if( i != d_index.end() )
+		return i.value();
+	return d_names.indexOf( field );
+}
+
+NumericBuffer Structure::getColumn(int i) const
+{
+	if( i >= 0 && i < d_columns.size() )
+		return d_columns[i];
 	else
-		return l.first();
+		return NumericBuffer();
 }
 
 Mat::Structure Structure::getStruct(const QByteArray &field) const
@@ -422,45 +1496,79 @@ Mat::NumericArray Structure::getArray(const QByteArray &field) const
 	return getValue(field).value<NumericArray>();
 }
 
-QVariant Structure::getArrayValue(const QByteArray &field, quint32 i) const
+QVariant Structure::getArrayValue(const QByteArray &field, qint64 i) const
 {
-	QVariantList l = d_fields.value(field);
-	if( l.isEmpty() )
-		return QVariant();
-	else if( l.first().canConvert<NumericArray>() )
-		return l.first().value<NumericArray>().getReal(i);
+	const QVariant v = getValue(field);
+	if( v.canConvert<NumericArray>() )
+		return v.value<NumericArray>().getReal(i);
 	else
 		return QVariant();
 }
 
-quint32 Structure::getArrayLen(const QByteArray &field) const
+qint64 Structure::getArrayLen(const QByteArray &field) const
 {
-	QVariantList l = d_fields.value(field);
-	if( l.isEmpty() )
+	const QVariant v = getValue(field);
+	if( v.canConvert<NumericArray>() )
+		return v.value<NumericArray>().d_real.size();
+	else
 		return 0;
-	else if( l.first().canConvert<NumericArray>() )
-		return l.first().value<NumericArray>().d_real.size();
+}
+
+static inline qint32 _index( const NumericBuffer& b, qint32 i )
+{
+	if( b.getType() == NumericBuffer::Int32 )
+		return b.constData<qint32>()[i];
 	else
+		return b.getValue(i).toInt();
+}
+
+qint32 SparseArray::getNonZeroCount() const
+{
+	if( d_jc.isEmpty() )
 		return 0;
+	else
+		return _index( d_jc, d_jc.size() - 1 );
 }
 
-QVariant NumericArray::getReal(int i) const
+QVariant SparseArray::getReal(int row, int col) const
 {
-	if( i >= d_real.size() )
+	if( d_dims.size() != 2 || row < 0 || row >= d_dims[0] || col < 0 || col >= d_dims[1] ||
+			col + 1 >= d_jc.size() )
 		return QVariant();
-	else
-		return d_real[i];
+	// Zeilenindizes sind je Spalte aufsteigend sortiert
+	qint32 lo = _index( d_jc, col );
+	qint32 hi = qMin( _index( d_jc, col + 1 ), qMin( d_ir.size(), d_real.size() ) );
+	while( lo < hi )
+	{
+		const qint32 mid = ( lo + hi ) / 2;
+		const qint32 r = _index( d_ir, mid );
+		if( r == row )
+			return d_real.getValue( mid );
+		else if( r < row )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	NumericBuffer zero( ( d_real.isValid() ) ? d_real.getType() : quint8(NumericBuffer::Double), 1 );
+	zero.fill( 0 );
+	return zero.getValue( 0 );
+}
+
+QVariant NumericArray::getReal(qint64 i) const
+{
+	if( i < 0 || i >= d_real.size() )
+		return QVariant();
+	return d_real.getValue( qint32(i) );
 }
 
-QVariant NumericArray::getReal(int row, int col) const
+QVariant NumericArray::getReal(qint64 row, qint64 col) const
 {
 	if( d_dims.size() != 2 )
 		return QVariant();
-	return getReal( row +
-					col * d_dims[0] );
+	return getReal( row + col * d_dims[0] );
 }
 
-QVariant NumericArray::getReal(int row, int col, int z) const
+QVariant NumericArray::getReal(qint64 row, qint64 col, qint64 z) const
 {
 	if( d_dims.size() == 2 )
 	{
@@ -472,61 +1580,65 @@ QVariant NumericArray::getReal(int row, int col, int z) const
 	}
 	if( d_dims.size() != 3 )
 		return QVariant();
-	return getReal( d_dims[ 0 ] * d_dims[ 1 ] * z +
-					col * d_dims[ 0 ] +
-					row );
+	return getReal( z * d_dims[ 0 ] * d_dims[ 1 ] + col * d_dims[ 0 ] + row );
 }
 
-void NumericArray::allocReal(int rows, const QVariant &val)
+static inline quint8 _allocType( const QVariant& val )
+{
+	const quint8 type = NumericBuffer::typeFromMetaType( val.userType() );
+	if( type == NumericBuffer::Invalid )
+		return NumericBuffer::Double;
+	else
+		return type;
+}
+
+void NumericArray::allocReal(qint64 rows, const QVariant &val)
 {
-	d_real.clear();
 	d_dims.resize(1);
 	d_dims[0] = rows;
-	for( int i = 0; i < rows; i++ )
-		d_real.append( val );
+	d_real = NumericBuffer( _allocType( val ), rows );
+	d_real.fill( val );
 }
 
-void NumericArray::allocReal(int rows, int cols, const QVariant &val)
+void NumericArray::allocReal(qint64 rows, qint64 cols, const QVariant &val)
 {
-	d_real.clear();
 	d_dims.resize(2);
 	d_dims[0] = rows;
 	d_dims[1] = cols;
-	for( int i = 0; i < ( rows * cols ); i++ )
-		d_real.append( val );
+	d_real = NumericBuffer( _allocType( val ), rows * cols ); // ungueltig bei mehr als MaxBytes
+	d_real.fill( val );
 }
 
-QVariant CellArray::getValue(quint32 i) const
+QVariant CellArray::getValue(qint64 i) const
 {
-	if( int(i) < d_cells.size() )
-		return d_cells[i];
+	if( i >= 0 && i < d_cells.size() )
+		return LazyMatrix::resolve( d_cells[int(i)] );
 	else
 		return QVariant();
 }
 
-QVariant CellArray::getValue(quint32 row, quint32 col) const
+QVariant CellArray::getValue(qint64 row, qint64 col) const
 {
 	if( d_dims.size() != 2 )
 		return QVariant();
 	return getValue( row + col * d_dims[0] );
 }
 
-Structure CellArray::getStruct(quint32 row, quint32 col) const
+Structure CellArray::getStruct(qint64 row, qint64 col) const
 {
 	return getValue( row, col ).value<Structure>();
 }
 
-QString CellArray::getString(quint32 i) const
+QString CellArray::getString(qint64 i) const
 {
-	if( int(i) >= d_cells.size() )
-		return QString();
-	else if( d_cells[i].canConvert<String>() )
-		return d_cells[i].value<String>().d_str;
+	const QVariant v = getValue(i);
+	if( v.canConvert<String>() )
+		return v.value<String>().d_str;
 	else
-		return d_cells[i].toString();
+		return v.toString();
 }
 
-QString CellArray::getString(quint32 row, quint32 col) const
+QString CellArray::getString(qint64 row, qint64 col) const
 {
 	if( d_dims.size() != 2 )
 		return QString();
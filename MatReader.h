@@ -30,11 +30,44 @@
 
 #include <QVariant>
 #include <QVector>
-
-class QIODevice;
+#include <QHash>
+#include <QPointer>
+#include <QIODevice>
+#include "MatBuffer.h"
+#include "MatLexer.h"
 
 namespace Mat
 {
+	class LazyMatrix
+	{
+		// Platzhalter fuer ein Feld oder eine Zelle, das erst beim ersten Zugriff dekodiert wird.
+		// Verweist entweder auf das Device (das dazu offen bleiben muss) oder auf eigene Bytes.
+	public:
+		LazyMatrix() {}
+		bool isValid() const { return d.data() != 0; }
+		bool isDecoded() const { return d.data() != 0 && d->d_done; }
+		QVariant getValue() const;
+		static QVariant resolve( const QVariant& ); // dekodiert v falls LazyMatrix, sonst v
+	private:
+		friend class MatReader;
+		struct Data : public QSharedData
+		{
+			QPointer<QIODevice> d_dev;
+			QByteArray d_src; // falls d_dev nicht gesetzt
+			qint64 d_pos;
+			qint64 d_len;
+			quint32 d_limit;
+			QExplicitlySharedDataPointer<Arena> d_arena; // Einstellungen des erzeugenden Readers
+			bool d_preview;
+			bool d_columnar;
+			bool d_swap;
+			bool d_done;
+			QVariant d_cache;
+			Data():d_pos(0),d_len(0),d_limit(0),d_preview(false),d_columnar(false),d_swap(false),d_done(false){}
+		};
+		QExplicitlySharedDataPointer<Data> d;
+	};
+
 	struct Matrix
 	{
 		QByteArray d_name;
@@ -48,13 +81,17 @@ namespace Mat
 	struct NumericArray : public Matrix
 	{
 		QVector<qint32> d_dims;
-		QVariantList d_real;
-		QVariantList d_img;
-		QVariant getReal(int i = 0) const;
-		QVariant getReal(int row, int col ) const;
-		QVariant getReal(int row, int col, int z ) const;
-		void allocReal( int rows, const QVariant& val = QVariant() );
-		void allocReal( int rows, int cols, const QVariant& val = QVariant() );
+		NumericBuffer d_real;
+		NumericBuffer d_img;
+		template<class T>
+		const T* constData() const { return d_real.constData<T>(); }
+		template<class T>
+		const T* constImgData() const { return d_img.constData<T>(); }
+		QVariant getReal(qint64 i = 0) const;
+		QVariant getReal(qint64 row, qint64 col ) const;
+		QVariant getReal(qint64 row, qint64 col, qint64 z ) const;
+		void allocReal( qint64 rows, const QVariant& val = QVariant() );
+		void allocReal( qint64 rows, qint64 cols, const QVariant& val = QVariant() );
 	};
 
 	struct String : public Matrix
@@ -68,27 +105,45 @@ namespace Mat
 		bool isObject() const { return !d_className.isEmpty(); }
 		QByteArray d_className;
 		QMap<QByteArray,QVariantList> d_fields;
+		// Mit MatReader::setColumnar stehen Felder, deren Zeilen alle reelle Skalare desselben Typs sind,
+		// als typisierte Spalte in d_columns statt in d_fields; der Index entspricht d_names.
+		QList<QByteArray> d_names; // Feldnamen in der Reihenfolge im File
+		QHash<QByteArray,int> d_index; // Feldname -> Index in d_names
+		QVector<NumericBuffer> d_columns;
+		int getFieldIndex( const QByteArray& field ) const;
+		NumericBuffer getColumn( int field ) const; // ungueltig, wenn das Feld in d_fields steht
 		QString getString( const QByteArray& field ) const;
 		QVariant getValue( const QByteArray& field ) const;
 		Structure getStruct( const QByteArray& field ) const;
 		NumericArray getArray( const QByteArray& field ) const;
-		QVariant getArrayValue( const QByteArray& field, quint32 = 0 ) const;
-		quint32 getArrayLen( const QByteArray& field ) const;
+		QVariant getArrayValue( const QByteArray& field, qint64 = 0 ) const;
+		qint64 getArrayLen( const QByteArray& field ) const;
 	};
 
 	struct CellArray : public Matrix
 	{
 		QVector<qint32> d_dims;
 		QVariantList d_cells;
-		QVariant getValue( quint32 i ) const;
-		QVariant getValue( quint32 row, quint32 col ) const;
-		Structure getStruct( quint32 row, quint32 col ) const;
-		QString getString( quint32 i ) const;
-		QString getString( quint32 row, quint32 col ) const;
+		QVariant getValue( qint64 i ) const;
+		QVariant getValue( qint64 row, qint64 col ) const;
+		Structure getStruct( qint64 row, qint64 col ) const;
+		QString getString( qint64 i ) const;
+		QString getString( qint64 row, qint64 col ) const;
 	};
 
 	struct SparseArray : public Matrix
 	{
+		// Compressed Sparse Column: die Werte von Spalte j stehen in d_real[d_jc[j]..d_jc[j+1]),
+		// die zugehoerigen Zeilen in d_ir an denselben Positionen.
+		QVector<qint32> d_dims;
+		quint32 d_nzmax;
+		NumericBuffer d_ir; // nzmax Zeilenindizes
+		NumericBuffer d_jc; // cols + 1 Spaltenanfaenge
+		NumericBuffer d_real;
+		NumericBuffer d_img;
+		qint32 getNonZeroCount() const;
+		QVariant getReal( int row, int col ) const; // 0 falls nicht gespeichert
+		SparseArray():d_nzmax(0){}
 	};
 
 	struct Undocumented : public Matrix
@@ -99,24 +154,155 @@ namespace Mat
 
 	class MatParser;
 
+	class ArrayCursor
+	{
+		// Liest den Realteil eines numerischen Arrays stueckweise direkt vom Stream, komprimiert oder nicht.
+		// Solange der Cursor verwendet wird, darf der Reader nicht anderweitig verwendet werden. Ist der
+		// Realteil gelesen oder die letzte Kopie geloescht, steht der Reader nach der Variable.
+	public:
+		ArrayCursor():d_count(0),d_pos(0),d_miType(0),d_type(0),d_swap(false),d_complex(false){}
+		bool isValid() const { return d_in.data() != 0; }
+		const QByteArray& getName() const { return d_name; }
+		const QVector<qint32>& getDims() const { return d_dims; }
+		quint8 getType() const { return d_type; } // NumericBuffer::Type der Klasse
+		bool isComplex() const { return d_complex; } // der Imaginaerteil wird vom Cursor nicht gelesen
+		qint64 getCount() const { return d_count; }
+		qint64 getPos() const { return d_pos; }
+		bool atEnd() const { return d_pos >= d_count; }
+		NumericBuffer next( qint32 maxCount = 131072 ); // Default 1 MiB Doubles; hoechstens MaxBytes
+	private:
+		friend class MatReader;
+		struct Level : public QSharedData
+		{
+			MatParser* d_parser;
+			QExplicitlySharedDataPointer<MatLexer::InStream> d_matrix; // Ebene der Variable im Parser
+			QExplicitlySharedDataPointer<MatLexer::InStream> d_in;
+			Level():d_parser(0){}
+			~Level() { leave(); }
+			void leave();
+		};
+		QExplicitlySharedDataPointer<MatLexer::InStream> d_in;
+		QExplicitlySharedDataPointer<Level> d_level; // nur bei MatReader::openArray
+		QByteArray d_name;
+		QVector<qint32> d_dims;
+		qint64 d_count;
+		qint64 d_pos;
+		quint8 d_miType;
+		quint8 d_type;
+		bool d_swap;
+		bool d_complex;
+	};
+
+	struct Variable
+	{
+		// Eintrag im Inhaltsverzeichnis; beschreibt eine Variable auf oberster Ebene ohne sie zu dekodieren
+		QByteArray d_name;
+		QVector<qint32> d_dims;
+		qint64 d_offset; // Position des Tags im File
+		qint64 d_size; // inkl. Tag und Padding
+		quint8 d_class; // mxXXX_CLASS
+		bool d_compressed;
+		Variable():d_offset(-1),d_size(0),d_class(0),d_compressed(false){}
+	};
+	typedef QList<Variable> Directory;
+
+	class MatVisitor
+	{
+		// Wird von MatReader::visit direkt aus den Tokens des Parsers aufgerufen, ohne QVariant Baum.
+		// Zeiger auf Daten gelten nur waehrend des Aufrufs.
+	public:
+		virtual ~MatVisitor() {}
+		// flags enthaelt logical (0x200), global (0x400) und complex (0x800); mxClass wie im File
+		virtual void beginMatrix( quint8 /*mxClass*/, quint32 /*flags*/, const QVector<qint32>& /*dims*/,
+								  const QByteArray& /*name*/ ) {}
+		virtual void endMatrix() {}
+		// part zaehlt die Datenelemente nach dem Header: Numeric 0=real, 1=imag; Sparse 0=ir, 1=jc, 2=real, 3=imag.
+		// type ist der gespeicherte NumericBuffer::Type, nicht zwingend der der Klasse. Die Daten eines
+		// Elements kommen stueckweise direkt vom Stream, d.h. mit mehreren Aufrufen fuer denselben part.
+		virtual void numericData( quint8 /*part*/, quint8 /*type*/, const void* /*data*/, qint32 /*count*/ ) {}
+		virtual void chars( const QString& ) {}
+		virtual void fieldNames( const QList<QByteArray>& ) {} // Structure und Object vor den Feldern
+		virtual void className( const QByteArray& ) {}
+	};
+
 	class MatReader
 	{
 	public:
 		MatReader();
 		~MatReader();
-		bool setDevice( QIODevice*, bool own = false );
+		bool setDevice( QIODevice*, bool own = false, bool mapped = false );
 		QVariant nextElement();
 		QString getError() const { return d_error; }
 		bool hasError() const { return !d_error.isEmpty(); }
-		quint16 getLimit() const;
-		void setLimit(quint16);
+		quint32 getLimit() const;
+		void setLimit(quint32);
+		// Bricht komprimierte Variablen nach dem limitierten Teil ab; siehe MatParser::setPreview
+		void setPreview( bool on );
+		bool isPreview() const;
+		Arena* getArena() const;
+		// Numerische Nutzdaten kommen aus der Arena; Reader und Buffer halten je eine Referenz, d.h. die Arena
+		// muss mit new erzeugt sein und wird mit der letzten Referenz geloescht. Siehe MatDocument.
+		void setArena( Arena* );
+		// Folgende Funktionen setzen ein Device voraus, das seek unterstuetzt
+		const Directory& readDirectory(); // danach steht der Reader wieder am Anfang
+		QVariant load( const QByteArray& name );
+		QVariant load( const Variable& );
+		// Liest alle (gewaehlten) Variablen; die Elemente werden parallel auf threadCount Threads dekodiert
+		// (0..ideal), das Resultat ist in der Reihenfolge im File. Es gelten dieselben Einstellungen wie bei
+		// nextElement; mit Arena erhaelt jedes Element eine eigene. Elemente ueber BigElement liest der Task
+		// bei unkomprimierten Variablen einer QFile selber, sonst werden sie hier sequentiell dekodiert.
+		QVariantList loadAll( int threadCount = 0 );
+		enum { BigElement = 16 * 1024 * 1024 };
+		bool visit( MatVisitor* ); // ab der aktuellen Position bis zum Ende
+		ArrayCursor openArray( const QByteArray& name );
+		ArrayCursor openArray( const Variable& );
+		// Teilarray mit offsets, counts und strides je Dimension (strides leer = 1); in unkomprimierten
+		// Elementen wird zu den benoetigten Bereichen gesprungen. Danach steht der Reader nach der Variable.
+		NumericArray readSlab( const QByteArray& name, const QVector<qint32>& offsets,
+							   const QVector<qint32>& counts, const QVector<qint32>& strides = QVector<qint32>() );
+		// Lazy: Felder von Structures und Zellen von CellArrays werden erst beim Zugriff dekodiert
+		void setLazy( bool on ) { d_lazy = on; }
+		bool isLazy() const { return d_lazy; }
+		// Columnar: Struct Arrays mit skalaren Feldern werden spaltenweise abgelegt (Structure::d_columns);
+		// zusammen mit Lazy werden solche Felder sofort dekodiert, auch beim spaeteren Dekodieren
+		void setColumnar( bool on ) { d_columnar = on; }
+		bool isColumnar() const { return d_columnar; }
+		// Es werden nur die Matrizen auf den Pfaden dekodiert, z.B. "results.trials{17}.spikes" oder "s(2).x"
+		// (Indizes ab 1, linear); nicht gewaehlte Felder und Zellen bleiben als ungueltige QVariant stehen,
+		// nicht gewaehlte Variablen ueberspringt nextElement. Leere Liste = alles.
+		bool setSelection( const QList<QByteArray>& paths );
 	private:
+		class ElementTask;
+		struct Selection;
+		static const Selection* select( const Selection*, qint32 item, const QByteArray& field, bool& selected );
+		QVariant readElement();
+		bool skipMatrix();
+		friend class LazyMatrix;
+		static QVariant decode( const LazyMatrix& );
+		QVariant readLazy();
+		bool visitMatrix( MatVisitor* );
+		bool visitLevel( MatVisitor* );
+		bool visitData( MatVisitor*, quint8 part, const MatLexer::DataElement& );
+		bool readHeader( quint32& flags, quint32& nzmax, QVector<qint32>& dims, QByteArray& name );
 		QVariant readMatrix();
+		QVariant readBody( quint32 flags, quint32 nzmax, const QVector<qint32>& dims, const QByteArray& name );
+		bool readColumnValue( Structure&, int field, QVariant& );
 		QVariant error( const char* );
-		bool readFields( Structure&, const QList<QByteArray> &names );
+		bool readFields( Structure&, const QList<QByteArray> &names, qint64 count );
+		enum { LazyScalarLen = 64 }; // Flags, 2 Dims, leerer Name und Daten bis 8 Bytes
+		void lazyToColumns( Structure& );
+		void skipRest( bool last );
 	private:
 		MatParser* d_parser;
 		QString d_error;
+		Directory d_dir;
+		QByteArray d_src; // bei decode der Inhalt des Device
+		Selection* d_sel;
+		const Selection* d_cur; // Auswahl fuer die aktuelle Ebene, 0 = alles
+		bool d_dirValid;
+		bool d_lazy;
+		bool d_columnar;
+		bool d_tail; // nach der aktuellen Matrix wird von der Variable nichts mehr benoetigt
 	};
 }
 
@@ -126,5 +312,6 @@ Q_DECLARE_METATYPE(Mat::Structure)
 Q_DECLARE_METATYPE(Mat::CellArray)
 Q_DECLARE_METATYPE(Mat::SparseArray)
 Q_DECLARE_METATYPE(Mat::Undocumented)
+Q_DECLARE_METATYPE(Mat::LazyMatrix)
 
 #endif // MATREADER_H
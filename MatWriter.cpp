@@ -32,7 +32,12 @@
 #include <QTemporaryFile>
 #include <QtDebug>
 #include <QDataStream>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
 #include "qtiocompressor.h"
+#include "zlib.h"
+#include <string.h>
 using namespace Mat;
 
 enum DataType { miINT8 = 1, miUINT8 = 2, miINT16 = 3, miUINT16 = 4, miINT32 = 5, miUINT32 = 6,
@@ -45,23 +50,157 @@ enum ArrayType { mxCELL_CLASS = 1, mxSTRUCT_CLASS = 2, mxOBJECT_CLASS = 3, mxCHA
 				 mxUINT8_CLASS = 9, mxINT16_CLASS = 10, mxUINT16_CLASS = 11, mxINT32_CLASS = 12,
 				 mxUINT32_CLASS = 13, mxINT64_CLASS = 14, mxUINT64_CLASS = 15 };
 
-static inline qint32 _totalCount( const MatWriter::Dims& v )
+static inline qint64 _totalCount( const MatWriter::Dims& v )
 {
 	if( v.isEmpty() )
 		return 0;
-	qint32 res = 1;
+	qint64 res = 1;
 	foreach( qint32 i, v )
 		res *= i;
 	return res;
 }
 
-MatWriter::MatWriter():d_owner(false)
+MatWriter::MatWriter():d_pool(0),d_blockSize(0),d_owner(false),d_direct(false)
 {
 }
 
+class MatWriter::DeflateTask : public QRunnable
+{
+public:
+	QIODevice* d_from;
+	qint64 d_len;
+	bool d_compress;
+	QByteArray d_result;
+	QSemaphore d_done;
+	DeflateTask( QIODevice* from, qint64 len, bool compress ):d_from(from),d_len(len),d_compress(compress)
+	{
+		setAutoDelete(false);
+	}
+	~DeflateTask() { delete d_from; }
+	void run()
+	{
+		QBuffer buf( &d_result );
+		buf.open( QIODevice::WriteOnly );
+		deflateMatrix( d_from, d_len, &buf );
+		d_done.release();
+	}
+};
+
+class MatWriter::BlockTask : public QRunnable
+{
+public:
+	QByteArray d_in;
+	QByteArray d_dict; // die letzten 32 KB des vorangehenden Blocks
+	QByteArray d_out;
+	quint32 d_adler;
+	bool d_last;
+	QSemaphore d_done;
+	BlockTask():d_adler(1),d_last(false)
+	{
+		setAutoDelete(false);
+	}
+	void run()
+	{
+		z_stream s;
+		::memset( &s, 0, sizeof(s) );
+		// roh ohne Header und Trailer; die setzt deflateBlocks fuer den ganzen Stream
+		deflateInit2( &s, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY );
+		if( !d_dict.isEmpty() )
+			deflateSetDictionary( &s, (const Bytef*)d_dict.constData(), d_dict.size() );
+		s.next_in = (Bytef*)d_in.data();
+		s.avail_in = d_in.size();
+		// Z_SYNC_FLUSH endet auf Bytegrenze ohne Final-Bit, so dass der naechste Block direkt anschliesst
+		const int flush = ( d_last ) ? Z_FINISH : Z_SYNC_FLUSH;
+		int res;
+		do
+		{
+			const int pos = d_out.size();
+			d_out.resize( pos + 0x10000 );
+			s.next_out = (Bytef*)d_out.data() + pos;
+			s.avail_out = 0x10000;
+			res = deflate( &s, flush );
+			d_out.resize( d_out.size() - s.avail_out );
+		}while( res == Z_OK && ( d_last || s.avail_out == 0 ) );
+		deflateEnd( &s );
+		d_adler = adler32( adler32( 0, 0, 0 ), (const Bytef*)d_in.constData(), d_in.size() );
+		d_done.release();
+	}
+};
+
 MatWriter::~MatWriter()
 {
 	release();
+	if( d_pool )
+		delete d_pool;
+}
+
+void MatWriter::setCompressionThreads(int threads)
+{
+	if( threads <= 0 )
+	{
+		flush();
+		if( d_pool )
+			delete d_pool;
+		d_pool = 0;
+		return;
+	}
+	if( d_pool == 0 )
+		d_pool = new QThreadPool();
+	d_pool->setMaxThreadCount( threads );
+}
+
+int MatWriter::getCompressionThreads() const
+{
+	if( d_pool )
+		return d_pool->maxThreadCount();
+	else
+		return 0;
+}
+
+void MatWriter::setDeflateBlockSize(qint32 bytes)
+{
+	if( bytes > 0 )
+		d_blockSize = qMax( bytes, 0x8000 ); // sonst reicht das Dictionary ueber mehr als einen Block zurueck
+	else
+		d_blockSize = 0;
+}
+
+void MatWriter::flush()
+{
+	drain( 0 );
+}
+
+void MatWriter::submit(QIODevice * from, qint64 len, bool compress)
+{
+	DeflateTask* t = new DeflateTask( from, len, compress );
+	d_pending.append( t );
+	if( compress )
+		d_pool->start( t );
+	else
+		t->d_done.release(); // wird erst beim Schreiben kopiert
+	// begrenzt den Speicherbedarf fuer gepufferte Variablen und Ergebnisse
+	drain( 2 * d_pool->maxThreadCount() );
+}
+
+void MatWriter::drain(int keep)
+{
+	while( !d_pending.isEmpty() )
+	{
+		DeflateTask* t = d_pending.first();
+		if( d_pending.size() > keep )
+			t->d_done.acquire();
+		else if( !t->d_done.tryAcquire() )
+			break;
+		d_pending.removeFirst();
+		QIODevice* to = d_level.first().d_out;
+		if( t->d_compress )
+		{
+			writeTag( to, miCOMPRESSED, t->d_result.size() );
+			to->write( t->d_result );
+		}else
+			copyMatrix( t->d_from, t->d_len, to );
+		delete t;
+	}
 }
 
 bool MatWriter::setDevice(QIODevice * out, bool own, bool _writeHeader)
@@ -74,6 +213,7 @@ bool MatWriter::setDevice(QIODevice * out, bool own, bool _writeHeader)
 			return false;
 	}
 	release();
+	d_error.clear();
 	d_level.append( Level(out) );
 	d_owner = own;
 	if( _writeHeader )
@@ -81,11 +221,30 @@ bool MatWriter::setDevice(QIODevice * out, bool own, bool _writeHeader)
 	return true;
 }
 
+void MatWriter::error(const char * msg)
+{
+	if( d_error.isEmpty() )
+		d_error = msg;
+}
+
 void MatWriter::beginMatrix(bool large)
 {
 	if( d_level.isEmpty() )
 		return;
 
+	QIODevice* parent = d_level.last().d_out;
+	if( ( d_level.size() > 1 || d_direct ) && !parent->isSequential() )
+	{
+		if( d_level.size() == 1 )
+			drain( 0 ); // Reihenfolge der Variablen einhalten
+		// Platzhalter im Normal Format; die Laenge wird in endMatrix nachgetragen
+		write( parent, qint32( miMATRIX ) );
+		write( parent, qint32( 0 ) );
+		Level l( parent );
+		l.d_start = parent->pos();
+		d_level.append( l );
+		return;
+	}
 	QIODevice* out = 0;
 	if( large )
 	{
@@ -102,54 +261,183 @@ void MatWriter::beginMatrix(bool large)
 
 void MatWriter::endMatrix(bool compress)
 {
-	Q_UNUSED( compress ); // TODO
 	if( d_level.size() < 2 )
 		return;
+	if( d_level.last().d_start >= 0 )
+	{
+		if( compress )
+			qWarning() << "MatWriter::endMatrix: a directly written matrix cannot be compressed";
+		QIODevice* out = d_level.last().d_out;
+		const qint64 end = out->pos();
+		const qint64 len = end - d_level.last().d_start;
+		if( len > 0xffffffffLL )
+		{
+			error( "matrix exceeds the 4 GB limit of the tag" );
+			d_level.removeLast();
+			return;
+		}
+		out->seek( d_level.last().d_start - 4 );
+		write( out, quint32( len ) );
+		out->seek( end );
+		// der Inhalt besteht aus Elementen mit 8 Byte Ausrichtung; nur der Vollstaendigkeit halber
+		if( len % 8 != 0 )
+			out->write( QByteArray( 8 - int( len % 8 ), char(0) ) );
+		d_level.removeLast();
+		return;
+	}
 	QIODevice* from = d_level.last().d_out;
 	QIODevice* to = d_level[ d_level.size() - 2 ].d_out;
-	const int len = from->pos();
+	const qint64 len = from->pos();
+	if( len > 0xffffffffLL )
+	{
+		error( "matrix exceeds the 4 GB limit of the tag" );
+		delete from;
+		d_level.removeLast();
+		return;
+	}
 	QByteArray buf;
 	buf.resize( 0xffff );
 	from->seek(0);
 
-	if( compress )
+	const bool blocks = compress && d_pool && d_blockSize > 0 && len > d_blockSize;
+	if( blocks )
+		drain( 0 ); // Reihenfolge der Variablen einhalten
+	if( d_pool && d_level.size() == 2 && !blocks )
 	{
-		QTemporaryFile temp;
-		temp.open();
-		QtIOCompressor cmp( &temp );
-		cmp.open(QIODevice::WriteOnly);
-		writeTag( &cmp, miMATRIX, len );
-		while( !from->atEnd() )
+		// from geht an die Task; unkomprimierte Variablen werden zur Einhaltung der Reihenfolge ebenfalls eingereiht
+		d_level.removeLast();
+		submit( from, len, compress );
+		return;
+	}else if( compress && !to->isSequential() )
+	{
+		// direkt ins Ziel deflaten; die Laenge der komprimierten Daten wird im Platzhalter nachgetragen
+		write( to, qint32( miCOMPRESSED ) );
+		write( to, qint32( 0 ) );
+		const qint64 start = to->pos();
+		if( blocks )
+			deflateBlocks( from, len, to );
+		else
+			deflateMatrix( from, len, to );
+		const qint64 end = to->pos();
+		const qint64 len2 = end - start;
+		if( len2 > 0xffffffffLL )
+			error( "compressed matrix exceeds the 4 GB limit of the tag" );
+		else
 		{
-			const int read = from->read( buf.data(), buf.size() );
-			cmp.write( buf.left(read) );
+			to->seek( start - 4 );
+			write( to, quint32( len2 ) );
+			to->seek( end );
 		}
-		writePadding( &cmp, len );
-		cmp.close();
-		const int len2 = temp.pos();
-		temp.seek(0);
-		writeTag( to, miCOMPRESSED, len2 );
-		while( !temp.atEnd() )
+	}else if( compress )
+	{
+		// Die Laenge muss vor den Daten stehen
+		QTemporaryFile temp;
+		temp.open();
+		if( blocks )
+			deflateBlocks( from, len, &temp );
+		else
+			deflateMatrix( from, len, &temp );
+		const qint64 len2 = temp.pos();
+		if( len2 > 0xffffffffLL )
+			error( "compressed matrix exceeds the 4 GB limit of the tag" );
+		else
 		{
-			const int read = temp.read( buf.data(), buf.size() );
-			to->write( buf.left(read) );
+			temp.seek(0);
+			writeTag( to, miCOMPRESSED, len2 );
+			while( !temp.atEnd() )
+			{
+				const int read = temp.read( buf.data(), buf.size() );
+				to->write( buf.constData(), read );
+			}
 		}
 	}else
+		copyMatrix( from, len, to );
+	delete d_level.last().d_out;
+	d_level.removeLast();
+}
+
+void MatWriter::deflateMatrix(QIODevice * from, qint64 len, QIODevice * to)
+{
+	QByteArray buf;
+	buf.resize( 0xffff );
+	QtIOCompressor cmp( to );
+	cmp.open(QIODevice::WriteOnly);
+	writeTag( &cmp, miMATRIX, len );
+	while( !from->atEnd() )
+	{
+		const int read = from->read( buf.data(), buf.size() );
+		cmp.write( buf.constData(), read );
+	}
+	writePadding( &cmp, len );
+	cmp.close(); // to bleibt offen
+}
+
+void MatWriter::deflateBlocks(QIODevice * from, qint64 len, QIODevice * to)
+{
+	Q_ASSERT( d_pool != 0 && d_blockSize > 0 );
+	// Header fuer deflate mit 32 KB Fenster und Standardlevel, wie von QtIOCompressor
+	to->write( "\x78\x9c", 2 );
+	QList<BlockTask*> pending;
+	QByteArray dict;
+	quint32 adler = adler32( 0, 0, 0 );
+	bool first = true;
+	bool last = false;
+	while( !last || !pending.isEmpty() )
 	{
-		writeTag( to, miMATRIX, len );
-		while( !from->atEnd() )
+		if( !last && pending.size() < 2 * d_pool->maxThreadCount() )
+		{
+			BlockTask* t = new BlockTask();
+			QBuffer buf( &t->d_in );
+			buf.open( QIODevice::WriteOnly );
+			if( first )
+				writeTag( &buf, miMATRIX, len );
+			first = false;
+			buf.write( from->read( d_blockSize - t->d_in.size() ) );
+			if( from->atEnd() )
+			{
+				writePadding( &buf, len );
+				t->d_last = last = true;
+			}
+			buf.close();
+			t->d_dict = dict;
+			dict = t->d_in.right( 0x8000 );
+			pending.append( t );
+			d_pool->start( t );
+		}else
 		{
-			const int read = from->read( buf.data(), buf.size() );
-			to->write( buf.left(read) );
+			BlockTask* t = pending.takeFirst();
+			t->d_done.acquire();
+			to->write( t->d_out );
+			adler = adler32_combine( adler, t->d_adler, t->d_in.size() );
+			delete t;
 		}
-		writePadding( to, len );
 	}
-	delete d_level.last().d_out;
-	d_level.removeLast();
+	// Trailer im Big Endian
+	char trailer[4];
+	trailer[0] = char( adler >> 24 );
+	trailer[1] = char( adler >> 16 );
+	trailer[2] = char( adler >> 8 );
+	trailer[3] = char( adler );
+	to->write( trailer, 4 );
+}
+
+void MatWriter::copyMatrix(QIODevice * from, qint64 len, QIODevice * to)
+{
+	QByteArray buf;
+	buf.resize( 0xffff );
+	writeTag( to, miMATRIX, len );
+	while( !from->atEnd() )
+	{
+		const int read = from->read( buf.data(), buf.size() );
+		to->write( buf.constData(), read );
+	}
+	writePadding( to, len );
 }
 
 void MatWriter::beginStructure(const QList<QByteArray> &fieldNames, int rowCount, bool large, const QByteArray &name)
 {
+	if( hasError() )
+		return;
 	beginMatrix( large );
 
 	Q_ASSERT( !d_level.isEmpty() );
@@ -180,6 +468,8 @@ void MatWriter::beginStructure(const QList<QByteArray> &fieldNames, int rowCount
 
 void MatWriter::addStructureRow(const QVariantList & l)
 {
+	if( hasError() )
+		return;
 	Q_ASSERT( !d_level.isEmpty() );
 	if( d_level.last().d_type.d_mxType != mxSTRUCT_CLASS || d_level.last().d_dims.size() < 2 )
 	{
@@ -203,6 +493,8 @@ void MatWriter::addStructureRow(const QVariantList & l)
 
 void MatWriter::endStructure(bool compress)
 {
+	if( hasError() )
+		return;
 	if( d_level.last().d_type.d_mxType != mxSTRUCT_CLASS )
 	{
 		qWarning() << "MatWriter::endStructure: not a structure";
@@ -216,23 +508,37 @@ void MatWriter::endStructure(bool compress)
 	endMatrix( compress );
 }
 
-void MatWriter::beginNumArray(const MatWriter::Dims & dims, int numType, bool large, const QByteArray &name)
+void MatWriter::beginNumArray(const MatWriter::Dims & dims, int numType, bool large, const QByteArray &name,
+							  bool complex)
 {
 	Q_ASSERT( isNumeric( numType ) );
-	beginMatrix(large);
+	if( hasError() )
+		return;
 	TypeLen t = matTypeFromMetaType( numType );
-	const qint32 count = _totalCount(dims);
-	d_level.last().d_dims << count;
-	t.d_len *= count;
+	const qint64 count = _totalCount(dims);
+	const qint64 len = count * t.d_len;
+	if( len > 0xffffffffLL )
+	{
+		error( "array exceeds the 4 GB limit of the tag" );
+		return;
+	}
+	beginMatrix(large);
+	d_level.last().d_left = count;
+	d_level.last().d_imag = ( complex ) ? count : -1;
+	t.d_len = quint32( len );
 	d_level.last().d_type = t;
-	writeArrayFlags( d_level.last().d_out, t.d_mxType );
+	writeArrayFlags( d_level.last().d_out, t.d_mxType | ( ( complex ) ? 0x800 : 0 ) );
 	writeArrayDims( d_level.last().d_out, dims );
 	writeDataElement( d_level.last().d_out, miINT8, name );
 	writeTag( d_level.last().d_out, t.d_miType, t.d_len );
+	if( complex && count == 0 )
+		advanceNumArray( 0 );
 }
 
 void MatWriter::addNumArrayElement(const QVariant & v)
 {
+	if( hasError() )
+		return;
 	Q_ASSERT( !d_level.isEmpty() );
 	if( !d_level.last().d_type.isNumArray() )
 	{
@@ -250,17 +556,21 @@ void MatWriter::addNumArrayElement(const QVariant & v)
 				qWarning() << "MatWriter::addNumArrayElement: incompatible element type" << v;
 				return;
 			}
+			if( d_level.last().d_left <= 0 )
+			{
+				qWarning() << "MatWriter::addNumArrayElement: too many elements";
+				return;
+			}
 			writeData( d_level.last().d_out, v );
+			advanceNumArray( 1 );
 		}
-		d_level.last().d_dims[0] -= l.size();
 	}else if( v.type() == QVariant::ByteArray )
 	{
 		// Array of UInt8
 		if( d_level.last().d_type.d_mxType == mxUINT8_CLASS )
 		{
 			const QByteArray data = v.toByteArray();
-			writeData( d_level.last().d_out, v );
-			d_level.last().d_dims[0] -= data.size();
+			addNumArrayData( NumericBuffer::UInt8, data.constData(), data.size() );
 			return;
 		}else
 		{
@@ -274,9 +584,126 @@ void MatWriter::addNumArrayElement(const QVariant & v)
 			qWarning() << "MatWriter::addNumArrayElement: incompatible element type" << v;
 			return;
 		}
+		if( d_level.last().d_left <= 0 )
+		{
+			qWarning() << "MatWriter::addNumArrayElement: too many elements";
+			return;
+		}
 		writeData( d_level.last().d_out, v );
-		d_level.last().d_dims[0] -= 1;
+		advanceNumArray( 1 );
+	}
+}
+
+void MatWriter::addNumArrayData(const NumericBuffer & b)
+{
+	addNumArrayData( b.getType(), b.getBytes().constData(), b.size() );
+}
+
+void MatWriter::addNumArrayData(quint8 type, const char * data, qint64 count)
+{
+	if( hasError() )
+		return;
+	Q_ASSERT( !d_level.isEmpty() );
+	Level& l = d_level.last();
+	if( !l.d_type.isNumArray() )
+	{
+		qWarning() << "MatWriter::addNumArrayData: not a numeric array";
+		return;
+	}
+	if( type != l.d_type.d_miType )
+	{
+		qWarning() << "MatWriter::addNumArrayData: incompatible element type" << type;
+		return;
+	}
+	// Die Daten werden in nativer Byte Order wie im Header angegeben ohne Umweg ueber QVariant geschrieben
+	const int size = NumericBuffer::elementSize( type );
+	while( count > 0 )
+	{
+		if( l.d_left <= 0 )
+		{
+			qWarning() << "MatWriter::addNumArrayData: too many elements";
+			return;
+		}
+		const qint64 n = qMin( count, l.d_left );
+		l.d_out->write( data, n * size );
+		data += n * size;
+		count -= n;
+		advanceNumArray( n );
+	}
+}
+
+void MatWriter::advanceNumArray(qint64 count)
+{
+	Level& l = d_level.last();
+	l.d_left -= count;
+	if( l.d_left == 0 && l.d_imag >= 0 )
+	{
+		// Realteil vollstaendig, der Imaginaerteil folgt als eigenes Datenelement
+		writePadding( l.d_out, l.d_type.d_len );
+		writeTag( l.d_out, l.d_type.d_miType, l.d_type.d_len );
+		l.d_left = l.d_imag;
+		l.d_imag = -1;
+	}
+}
+
+void MatWriter::beginSparseArray(const MatWriter::Dims & dims, const NumericBuffer & ir, const NumericBuffer & jc,
+								 bool complex, bool large, const QByteArray &name)
+{
+	if( hasError() )
+		return;
+	Q_ASSERT( dims.size() == 2 );
+	Q_ASSERT( ir.getType() == NumericBuffer::Int32 && jc.getType() == NumericBuffer::Int32 );
+	if( jc.size() != dims[1] + 1 )
+		qWarning() << "MatWriter::beginSparseArray: jc must have cols + 1 elements";
+	beginMatrix(large);
+	Level& l = d_level.last();
+	l.d_type.d_mxType = mxSPARSE_CLASS;
+	const qint32 nnz = ( jc.isEmpty() ) ? 0 : jc.constData<qint32>()[ jc.size() - 1 ];
+	l.d_dims << ( ( complex ) ? 2 : 1 ) << nnz; // noch erwartete Wertebloecke und deren Laenge
+	writeArrayFlags( l.d_out, mxSPARSE_CLASS | ( ( complex ) ? 0x800 : 0 ), qMax( ir.size(), 1 ) );
+	writeArrayDims( l.d_out, dims );
+	writeArrayName( l.d_out, name );
+	writeBuffer( l.d_out, ir );
+	writeBuffer( l.d_out, jc );
+}
+
+void MatWriter::addSparseValues(const NumericBuffer & v)
+{
+	if( hasError() )
+		return;
+	Q_ASSERT( !d_level.isEmpty() );
+	Level& l = d_level.last();
+	if( l.d_type.d_mxType != mxSPARSE_CLASS || l.d_dims.size() != 2 )
+	{
+		qWarning() << "MatWriter::addSparseValues: not a sparse array";
+		return;
 	}
+	if( l.d_dims[0] <= 0 )
+	{
+		qWarning() << "MatWriter::addSparseValues: too many value parts";
+		return;
+	}
+	if( v.size() != l.d_dims[1] )
+		qWarning() << "MatWriter::addSparseValues: number of values differs from jc";
+	writeBuffer( l.d_out, v );
+	l.d_dims[0]--;
+}
+
+void MatWriter::endSparseArray(bool compress)
+{
+	if( hasError() )
+		return;
+	if( d_level.last().d_type.d_mxType != mxSPARSE_CLASS )
+	{
+		qWarning() << "MatWriter::endSparseArray: not a sparse array";
+		return;
+	}
+	if( d_level.last().d_dims[0] > 0 )
+	{
+		qWarning() << "MatWriter::endSparseArray: not all value parts written";
+		return;
+	}
+	endMatrix( compress );
 }
 
 void MatWriter::writeCell(const QVariant & val, const QByteArray &name)
@@ -372,9 +799,11 @@ void MatWriter::writeCell(const QVariant & val, const QByteArray &name)
 
 void MatWriter::release()
 {
+	if( !d_level.isEmpty() )
+		drain( 0 );
 	for( int i = 0; i < d_level.size(); i++ )
 	{
-		if( i != 0 || d_owner )
+		if( ( i != 0 || d_owner ) && d_level[i].d_start < 0 )
 			delete d_level[i].d_out;
 	}
 	d_level.clear();
@@ -436,14 +865,14 @@ void MatWriter::writeTag(QIODevice* out , quint8 miType, quint32 byteLen )
 	}
 }
 
-void MatWriter::writePadding(QIODevice* out, int len)
+void MatWriter::writePadding(QIODevice* out, qint64 len)
 {
 	if( len <= 4 )
 	{
 		out->write( QByteArray( 4 - len, char(0) ) );
 	}else
 	{
-		const int padding = ( 8 - ( len % 8 ) ) % 8;
+		const int padding = ( 8 - int( len % 8 ) ) % 8;
 		out->write( QByteArray( padding, char(0) ) );
 	}
 }
@@ -502,6 +931,12 @@ void MatWriter::writeData(QIODevice * out, const QVariant & v)
 	}
 }
 
+void MatWriter::writeBuffer(QIODevice * out, const NumericBuffer & b)
+{
+	// NumericBuffer::Type entspricht dem miXXX Typ
+	writeDataElement( out, b.getType(), b.getBytes() );
+}
+
 void MatWriter::writeArrayDims(QIODevice * out, const Dims & dims)
 {
 	const int len = 4 * dims.size();
@@ -511,11 +946,11 @@ void MatWriter::writeArrayDims(QIODevice * out, const Dims & dims)
 	writePadding( out, len );
 }
 
-void MatWriter::writeArrayFlags(QIODevice * out, quint16 type)
+void MatWriter::writeArrayFlags(QIODevice * out, quint32 flags, quint32 nzmax)
 {
 	writeTag( out, miUINT32, 2 * 4 );
-	write( out, qint32(type) );
-	write( out, qint32( 0 ) );
+	write( out, flags );
+	write( out, nzmax );
 }
 
 void MatWriter::writeArrayName(QIODevice * out, const QByteArray & name)
@@ -595,6 +1030,8 @@ bool MatWriter::isString(int metaType)
 
 void MatWriter::addCharArray(const QString & str, const QByteArray &name)
 {
+	if( hasError() )
+		return;
 	const QByteArray utf8 = str.toUtf8();
 
 	Dims dims;
@@ -611,12 +1048,14 @@ void MatWriter::addCharArray(const QString & str, const QByteArray &name)
 
 void MatWriter::endNumArray(bool compress)
 {
+	if( hasError() )
+		return;
 	if( !d_level.last().d_type.isNumArray() )
 	{
 		qWarning() << "MatWriter::endNumArray: not a numeric array";
 		return;
 	}
-	if( d_level.last().d_dims[0] > 0 )
+	if( d_level.last().d_left > 0 || d_level.last().d_imag >= 0 )
 	{
 		qWarning() << "MatWriter::endNumArray: not all elements written";
 		return;
@@ -32,6 +32,9 @@
 #include <QVariant>
 #include <QVector>
 #include <QPair>
+#include "MatBuffer.h"
+
+class QThreadPool;
 
 namespace Mat
 {
@@ -57,28 +60,66 @@ namespace Mat
 		MatWriter();
 		~MatWriter();
 		bool setDevice( QIODevice*, bool own = false, bool writeHeader = true );
+		// Eingebettete Matrizen werden immer direkt ins Device der Elternebene geschrieben, sofern dieses seek
+		// unterstuetzt; die Laenge im Tag wird am Ende nachgetragen. Mit setDirect gilt das auch fuer Variablen
+		// auf oberster Ebene, die dann aber nicht komprimiert werden koennen.
+		void setDirect( bool on ) { d_direct = on; }
+		bool isDirect() const { return d_direct; }
+		// Mit threads > 0 werden Variablen auf oberster Ebene in endXXX(true) parallel komprimiert und in der
+		// Reihenfolge ihres Abschlusses geschrieben, spaetestens mit flush, setDevice oder im Destruktor.
+		void setCompressionThreads( int threads );
+		int getCompressionThreads() const;
+		void flush();
+		// Ein Element ueber 4 GB passt nicht in den Tag; es wird nicht geschrieben und alle weiteren Aufrufe
+		// werden ignoriert, bis setDevice ein neues Device setzt.
+		bool hasError() const { return !d_error.isEmpty(); }
+		const QString& getError() const { return d_error; }
+		// Mit Threads und bytes > 0 wird eine Variable, die groesser ist, wie bei pigz in Bloecken parallel
+		// komprimiert; das Ergebnis bleibt ein einziger zlib Stream. Mindestens 32 KB.
+		void setDeflateBlockSize( qint32 bytes );
+		qint32 getDeflateBlockSize() const { return d_blockSize; }
 		void beginStructure( const QList<QByteArray>& fieldNames, int rowCount = 1, bool large = false, const QByteArray& name = QByteArray() );
 		void addStructureRow( const QVariantList& );
 		void endStructure(bool compress = false);
-		void beginNumArray( const Dims&, int numType, bool large = false, const QByteArray& name = QByteArray() ); // QMetaType::Type
+		// Bei complex folgen auf die Elemente des Realteils gleich viele des Imaginaerteils
+		void beginNumArray( const Dims&, int numType, bool large = false, const QByteArray& name = QByteArray(),
+							bool complex = false ); // QMetaType::Type
 		void addNumArrayElement( const QVariant& );
+		// Schreibt count Elemente am Stueck; der Typ muss dem des Arrays entsprechen
+		template<class T>
+		void addNumArrayData( const T* data, qint64 count )
+		{
+			addNumArrayData( NumericBuffer::typeOf<T>(), (const char*)data, count );
+		}
+		void addNumArrayData( const NumericBuffer& );
+		void addNumArrayData( quint8 type, const char* data, qint64 count ); // type als NumericBuffer::Type
 		void endNumArray(bool compress = false);
 		void addCharArray( const QString&, const QByteArray& name = QByteArray() );
-		// TODO: CellArray, Object, SparseArray
+		// ir und jc als Int32 in CSC Form; danach Realteil und ggf. Imaginaerteil mit addSparseValues
+		void beginSparseArray( const Dims&, const NumericBuffer& ir, const NumericBuffer& jc, bool complex = false,
+							   bool large = false, const QByteArray& name = QByteArray() );
+		void addSparseValues( const NumericBuffer& );
+		void endSparseArray(bool compress = false);
+		// TODO: CellArray, Object
 	protected:
 		void beginMatrix( bool large = false );
 		void endMatrix( bool compress = false );
 		void writeCell( const QVariant&, const QByteArray& name = QByteArray() );
+		void advanceNumArray( qint64 count );
+		static void deflateMatrix( QIODevice* from, qint64 len, QIODevice* to ); // miMATRIX als zlib Stream
+		static void copyMatrix( QIODevice* from, qint64 len, QIODevice* to ); // miMATRIX unkomprimiert
+		void deflateBlocks( QIODevice* from, qint64 len, QIODevice* to ); // wie deflateMatrix, aber parallel
 		void release();
 		void writeHeader();
 		// Primitiven
 		static void writeTag( QIODevice*, quint8 miType, quint32 byteLen );
-		static void writePadding( QIODevice*, int len );
+		static void writePadding( QIODevice*, qint64 len );
 		static void writeData( QIODevice*, const QVariant& );
+		static void writeBuffer( QIODevice*, const NumericBuffer& );
 		// Elemente
 		static void writeDataElement( QIODevice*, quint16 miType, const QByteArray& );
 		static void writeArrayDims( QIODevice*, const Dims& );
-		static void writeArrayFlags( QIODevice*, quint16 type );
+		static void writeArrayFlags( QIODevice*, quint32 flags, quint32 nzmax = 0 ); // flags inkl. mxXXX_CLASS
 		static void writeArrayName( QIODevice*, const QByteArray& );
 		struct TypeLen
 		{
@@ -92,15 +133,29 @@ namespace Mat
 		static bool isNumeric( int metaType );
 		static bool isString( int metaType );
 	private:
+		class DeflateTask;
+		class BlockTask;
+		void submit( QIODevice* from, qint64 len, bool compress );
+		void drain( int keep );
+		void error( const char* );
 		struct Level
 		{
 			QIODevice* d_out;
 			TypeLen d_type;
 			Dims d_dims;
-			Level( QIODevice* out = 0, quint8 mxType = 0 ):d_type(0, mxType, 0),d_out(out){}
+			qint64 d_left; // noch zu schreibende Elemente des aktuellen Teils eines NumArray
+			qint64 d_imag; // Elemente des noch ausstehenden Imaginaerteils oder -1
+			qint64 d_start; // direkt ins Device der Elternebene geschrieben: Position nach dem Tag, sonst -1
+			Level( QIODevice* out = 0, quint8 mxType = 0 ):d_type(0, mxType, 0),d_out(out),d_left(0),d_imag(-1),
+				d_start(-1){}
 		};
 		QList<Level> d_level;
+		QList<DeflateTask*> d_pending; // in der Reihenfolge von endMatrix
+		QThreadPool* d_pool;
+		QString d_error;
+		qint32 d_blockSize;
 		bool d_owner;
+		bool d_direct;
 	};
 }
 
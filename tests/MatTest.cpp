@@ -0,0 +1,1390 @@
+/*
+* Copyright 2016-2018 Rochus Keller <mailto:me@rochus-keller.info>
+*
+* This file is part of the Mat5 library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.info.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*
+* GNU Lesser General Public License Usage
+* Alternatively, this file may be used under the terms of the GNU Lesser
+* General Public License version 3 as published by the Free Software
+* Foundation and appearing in the file LICENSE.LGPL included in the
+* packaging of this file. Please review the following information to
+* ensure the GNU Lesser General Public License version 3 requirements
+* will be met: https://www.gnu.org/licenses/lgpl-3.0.html.
+*/
+
+
+// Round-trip Tests fuer MatWriter und MatReader; Rueckgabe 0, wenn alles gelingt
+
+#include "MatWriter.h"
+#include "MatReader.h"
+#include "MatParser.h"
+#include "MatLexer.h"
+#include "MatDocument.h"
+#include "MatLoader.h"
+#include <QCoreApplication>
+#include <QBuffer>
+#include <QTemporaryFile>
+#include <QSysInfo>
+#include <QtDebug>
+using namespace Mat;
+
+enum DataType { miINT8 = 1, miINT16 = 3, miINT32 = 5, miUINT32 = 6, miDOUBLE = 9, miMATRIX = 14,
+				miCOMPRESSED = 15, miUTF16 = 17 };
+enum ArrayType { mxSTRUCT_CLASS = 2, mxCHAR_CLASS = 4, mxDOUBLE_CLASS = 6, mxINT16_CLASS = 10 };
+
+static int s_failures = 0;
+
+#define CHECK( x ) do { if( !( x ) ) { qWarning() << "FAIL" << __FILE__ << __LINE__ << #x; s_failures++; } } while( 0 )
+
+static int s_warnings = 0;
+
+#if QT_VERSION >= 0x050000
+static void _countWarnings( QtMsgType t, const QMessageLogContext&, const QString& )
+#else
+static void _countWarnings( QtMsgType t, const char* )
+#endif
+{
+	if( t == QtWarningMsg )
+		s_warnings++;
+}
+
+// Von Hand erzeugte Elemente fuer das, was MatWriter nicht kann (verschachtelte Structs, Big Endian)
+static bool s_bigEndian = false;
+
+static void _put( QByteArray& out, const void* p, int len )
+{
+	const char* c = (const char*)p;
+	const bool swap = s_bigEndian != ( QSysInfo::ByteOrder == QSysInfo::BigEndian );
+	for( int i = 0; i < len; i++ )
+		out.append( c[ swap ? len - 1 - i : i ] );
+}
+
+template<class T>
+static void _put( QByteArray& out, T v )
+{
+	_put( out, &v, sizeof(T) );
+}
+
+static QByteArray _element( quint32 miType, const QByteArray& data )
+{
+	QByteArray out;
+	_put( out, miType );
+	_put( out, quint32( data.size() ) );
+	out += data;
+	if( data.size() % 8 )
+		out += QByteArray( 8 - data.size() % 8, 0 );
+	return out;
+}
+
+static QByteArray _compressed( const QByteArray& element )
+{
+	const QByteArray z = qCompress( element ).mid( 4 ); // ohne Laengenpraefix von Qt
+	QByteArray out;
+	_put( out, quint32( miCOMPRESSED ) );
+	_put( out, quint32( z.size() ) );
+	return out + z;
+}
+
+static QByteArray _matrix( quint32 mxClass, qint32 rows, qint32 cols, const QByteArray& name, const QByteArray& body )
+{
+	QByteArray flags, dims;
+	_put( flags, mxClass );
+	_put( flags, quint32( 0 ) );
+	_put( dims, rows );
+	_put( dims, cols );
+	return _element( miMATRIX, _element( miUINT32, flags ) + _element( miINT32, dims ) +
+					 _element( miINT8, name ) + body );
+}
+
+static QByteArray _doubles( const QVector<double>& v, const QByteArray& name = QByteArray() )
+{
+	QByteArray data;
+	for( int i = 0; i < v.size(); i++ )
+		_put( data, v[i] );
+	return _matrix( mxDOUBLE_CLASS, 1, v.size(), name, _element( miDOUBLE, data ) );
+}
+
+static QByteArray _scalar( double v, const QByteArray& name = QByteArray() )
+{
+	return _doubles( QVector<double>() << v, name );
+}
+
+static QByteArray _chars( const QString& str, const QByteArray& name = QByteArray() )
+{
+	QByteArray data;
+	for( int i = 0; i < str.size(); i++ )
+		_put( data, quint16( str[i].unicode() ) );
+	return _matrix( mxCHAR_CLASS, 1, str.size(), name, _element( miUTF16, data ) );
+}
+
+// cells zeilenweise, d.h. alle Felder der ersten Zeile, dann der zweiten usw.
+static QByteArray _struct( const QList<QByteArray>& names, qint32 rows, const QList<QByteArray>& cells,
+						   const QByteArray& name = QByteArray() )
+{
+	QByteArray len, fields;
+	_put( len, qint32( 32 ) );
+	foreach( const QByteArray& n, names )
+		fields += n + QByteArray( 32 - n.size(), 0 );
+	QByteArray body = _element( miINT32, len ) + _element( miINT8, fields );
+	foreach( const QByteArray& c, cells )
+		body += c;
+	return _matrix( mxSTRUCT_CLASS, rows, 1, name, body );
+}
+
+static QByteArray _header()
+{
+	QByteArray h = "MATLAB 5.0 MAT-file, MatTest";
+	h += QByteArray( 116 - h.size(), ' ' );
+	h += QByteArray( 8, 0 );
+	_put( h, quint16( 0x0100 ) );
+	_put( h, quint16( 0x4d49 ) );
+	return h;
+}
+
+static void testBlocks()
+{
+	for( int threads = 1; threads <= 4; threads += 3 )
+	{
+		QVector<double> re( 100001 );
+		QTemporaryFile f;
+		CHECK( f.open() );
+		{
+			MatWriter w;
+			w.setCompressionThreads( threads );
+			w.setDeflateBlockSize( 1 );
+			w.setDevice( &f );
+			CHECK( w.getDeflateBlockSize() == 0x8000 );
+			MatWriter::Dims dims;
+			dims << 1 << 3;
+			w.beginNumArray( dims, QVariant::Double, false, "a" );
+			for( int i = 0; i < 3; i++ )
+				w.addNumArrayElement( double(i) );
+			w.endNumArray( true );
+			dims.clear();
+			dims << 1 << re.size();
+			for( int i = 0; i < re.size(); i++ )
+				re[i] = ( i * 7919 ) % 1000;
+			w.beginNumArray( dims, QVariant::Double, true, "big" );
+			w.addNumArrayData( re.constData(), re.size() );
+			w.endNumArray( true );
+			dims.clear();
+			dims << 1 << 1;
+			w.beginNumArray( dims, QVariant::Double, false, "z" );
+			w.addNumArrayElement( 5.0 );
+			w.endNumArray( false );
+		}
+		f.reset();
+		MatReader r;
+		CHECK( r.setDevice( &f ) );
+		NumericArray a = r.nextElement().value<NumericArray>();
+		CHECK( !r.hasError() && a.d_name == "a" && a.d_real.size() == 3 );
+		a = r.nextElement().value<NumericArray>();
+		CHECK( !r.hasError() && a.d_name == "big" && a.d_real.size() == re.size() );
+		bool ok = a.d_real.size() == re.size();
+		for( int i = 0; ok && i < re.size(); i++ )
+			ok = a.constData<double>()[i] == re[i];
+		CHECK( ok );
+		a = r.nextElement().value<NumericArray>();
+		CHECK( !r.hasError() && a.d_name == "z" && a.constData<double>()[0] == 5.0 );
+	}
+}
+
+static QByteArray writeSample( bool compress, bool direct = false )
+{
+	QBuffer buf;
+	buf.open( QIODevice::ReadWrite );
+	MatWriter w;
+	w.setDevice( &buf );
+	w.setDirect( direct );
+	MatWriter::Dims dims;
+	dims << 2 << 3;
+	w.beginNumArray( dims, QVariant::Double, false, "a" );
+	for( int i = 0; i < 6; i++ )
+		w.addNumArrayElement( double(i) + 0.5 );
+	w.endNumArray( compress );
+	w.addCharArray( "hello", "s" );
+	QList<QByteArray> names;
+	names << "x" << "y";
+	w.beginStructure( names, 2, false, "st" );
+	w.addStructureRow( QVariantList() << QVariant( int(1) ) << QVariant( "abc" ) );
+	w.addStructureRow( QVariantList() << QVariant( int(2) ) << QVariant( 3.5 ) );
+	w.endStructure( compress );
+	w.flush();
+	return buf.data();
+}
+
+static void testRead( bool compress )
+{
+	QBuffer buf;
+	buf.setData( writeSample( compress ) );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	QVariant v = r.nextElement();
+	CHECK( !r.hasError() && v.canConvert<NumericArray>() );
+	NumericArray a = v.value<NumericArray>();
+	CHECK( a.d_name == "a" && a.d_dims.size() == 2 && a.d_dims[0] == 2 && a.d_dims[1] == 3 );
+	CHECK( a.getReal( 1, 2 ).toDouble() == 5.5 );
+	CHECK( a.d_real.getType() == NumericBuffer::Double && a.d_real.size() == 6 && a.constData<double>()[5] == 5.5 );
+	v = r.nextElement();
+	CHECK( v.canConvert<String>() && v.value<String>().d_str == "hello" );
+	v = r.nextElement();
+	CHECK( !r.hasError() && v.canConvert<Structure>() );
+	Structure s = v.value<Structure>();
+	CHECK( s.d_fields.size() == 2 && s.d_fields["x"].size() == 2 );
+	CHECK( s.getArray( "x" ).d_real.getType() == NumericBuffer::Int32 && s.getArray( "x" ).getReal().toInt() == 1 );
+	CHECK( s.getString( "y" ) == "abc" );
+	CHECK( !r.nextElement().isValid() && !r.hasError() );
+}
+
+static void testMapped()
+{
+	QTemporaryFile f;
+	CHECK( f.open() );
+	{
+		MatWriter w;
+		w.setDevice( &f );
+		w.addCharArray( "hello", "s" );
+		// gross genug, dass das Element nicht inline gelesen wird (MatLexer::InlineLimit)
+		MatWriter::Dims dims;
+		dims << 1 << 1000;
+		w.beginNumArray( dims, QVariant::Double, false, "m" );
+		for( int i = 0; i < 1000; i++ )
+			w.addNumArrayElement( i + 0.25 );
+		w.endNumArray();
+	}
+	f.reset();
+	const QByteArray data = f.readAll();
+	f.reset();
+	MatReader r;
+	CHECK( r.setDevice( &f, false, true ) );
+	CHECK( r.nextElement().value<String>().d_str == "hello" );
+	NumericArray a = r.nextElement().value<NumericArray>();
+	CHECK( !r.hasError() && a.d_name == "m" && a.d_real.size() == 1000 && a.constData<double>()[999] == 999.25 );
+
+	// Zero-Copy: eine Aenderung im File muss im Buffer sichtbar sein
+	const int off = data.indexOf( QByteArray( a.d_real.getBytes().constData(), 16 ) );
+	CHECK( off > 0 );
+	QFile g( f.fileName() );
+	CHECK( g.open( QIODevice::ReadWrite ) && g.seek( off ) );
+	const double v = 42.0;
+	g.write( (const char*)&v, sizeof(v) );
+	g.close();
+	CHECK( a.constData<double>()[0] == 42.0 );
+}
+
+static void testDirectory( bool compress )
+{
+	const QByteArray data = writeSample( compress );
+	QBuffer buf;
+	buf.setData( data );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	const Directory& dir = r.readDirectory();
+	CHECK( !r.hasError() && dir.size() == 3 );
+	if( dir.size() == 3 )
+	{
+		CHECK( dir[0].d_name == "a" && dir[0].d_class == mxDOUBLE_CLASS && dir[0].d_dims.size() == 2 );
+		CHECK( dir[0].d_compressed == compress && dir[0].d_offset == 128 );
+		CHECK( dir[1].d_name == "s" && dir[1].d_class == mxCHAR_CLASS );
+		CHECK( dir[2].d_name == "st" && dir[2].d_offset + dir[2].d_size == data.size() );
+	}
+	CHECK( r.load( "st" ).value<Structure>().getString( "y" ) == "abc" && !r.hasError() );
+	CHECK( r.load( "a" ).value<NumericArray>().getReal( 1, 2 ).toDouble() == 5.5 );
+	CHECK( r.load( "s" ).value<String>().d_str == "hello" );
+	CHECK( !r.load( "nope" ).isValid() );
+}
+
+static void testLazy( bool compress, bool file )
+{
+	QBuffer out;
+	out.open( QIODevice::ReadWrite );
+	{
+		MatWriter w;
+		w.setDevice( &out );
+		QList<QByteArray> names;
+		names << "x" << "y";
+		w.beginStructure( names, 2, false, "st" );
+		w.addStructureRow( QVariantList() << QVariant( 4.25 ) << QVariant( QVariantList() << 7.0 << 8.0 ) );
+		w.addStructureRow( QVariantList() << QVariant( 1.0 ) << QVariant( "zz" ) );
+		w.endStructure( compress );
+	}
+	QBuffer buf;
+	buf.setData( out.data() );
+	buf.open( QIODevice::ReadOnly );
+	QTemporaryFile f;
+	QIODevice* dev = &buf;
+	if( file )
+	{
+		f.open();
+		f.write( out.data() );
+		f.flush();
+		f.reset();
+		dev = &f;
+	}
+	MatReader r;
+	r.setLazy( true );
+	CHECK( r.setDevice( dev ) );
+	Structure s = r.nextElement().value<Structure>();
+	CHECK( !r.hasError() && s.d_fields["x"].first().userType() == qMetaTypeId<LazyMatrix>() );
+	CHECK( s.getArray( "x" ).getReal().toDouble() == 4.25 );
+	CHECK( s.d_fields["x"].first().value<LazyMatrix>().isDecoded() );
+	CHECK( s.getArrayLen( "y" ) == 2 && s.getArrayValue( "y", 1 ).toDouble() == 8.0 );
+	CHECK( s.d_fields["y"].size() == 2 && LazyMatrix::resolve( s.d_fields["y"][1] ).value<String>().d_str == "zz" );
+	CHECK( !r.nextElement().isValid() && !r.hasError() );
+}
+
+static void testLazySettings()
+{
+	QVector<double> x( 300 );
+	for( int i = 0; i < x.size(); i++ )
+		x[i] = i;
+	QList<QByteArray> rows;
+	rows << _scalar( 0.5 ) << _scalar( 1.5 ) << _scalar( 2.5 );
+	const QByteArray log = _struct( QList<QByteArray>() << "t", 3, rows );
+	const QByteArray data = _header() + _struct( QList<QByteArray>() << "log" << "x", 1,
+												 QList<QByteArray>() << log << _doubles( x ), "outer" );
+	QBuffer buf;
+	buf.setData( data );
+	buf.open( QIODevice::ReadOnly );
+	QExplicitlySharedDataPointer<Arena> arena( new Arena() );
+	MatReader r;
+	r.setLazy( true );
+	r.setColumnar( true );
+	r.setArena( arena.data() );
+	CHECK( r.setDevice( &buf ) );
+	Structure s = r.nextElement().value<Structure>();
+	CHECK( !r.hasError() && s.d_fields["x"].first().userType() == qMetaTypeId<LazyMatrix>() );
+	// die Einstellungen des Readers gelten auch beim spaeteren Dekodieren
+	const qint64 used = arena->getUsed();
+	Structure l = s.getStruct( "log" );
+	CHECK( l.getColumn( l.getFieldIndex( "t" ) ).size() == 3 && l.getColumn( 0 ).constData<double>()[2] == 2.5 );
+	CHECK( s.getArray( "x" ).constData<double>()[299] == 299.0 && arena->getUsed() >= used + 300 * 8 );
+}
+
+static void testSparse( bool compress )
+{
+	// 3x4 mit (0,0)=1 (2,0)=2 (1,2)=3 (2,3)=4
+	QBuffer out;
+	out.open( QIODevice::ReadWrite );
+	{
+		MatWriter w;
+		w.setDevice( &out );
+		NumericBuffer ir( NumericBuffer::Int32, 4 ), jc( NumericBuffer::Int32, 5 );
+		NumericBuffer pr( NumericBuffer::Double, 4 ), pi( NumericBuffer::Double, 4 );
+		const qint32 irv[] = { 0, 2, 1, 2 }, jcv[] = { 0, 2, 2, 3, 4 };
+		for( int i = 0; i < 4; i++ )
+		{
+			ir.data<qint32>()[i] = irv[i];
+			pr.data<double>()[i] = i + 1;
+			pi.data<double>()[i] = -i;
+		}
+		for( int i = 0; i < 5; i++ )
+			jc.data<qint32>()[i] = jcv[i];
+		MatWriter::Dims dims;
+		dims << 3 << 4;
+		w.beginSparseArray( dims, ir, jc, true, false, "sp" );
+		w.addSparseValues( pr );
+		w.addSparseValues( pi );
+		w.endSparseArray( compress );
+	}
+	QBuffer buf;
+	buf.setData( out.data() );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	SparseArray a = r.nextElement().value<SparseArray>();
+	CHECK( !r.hasError() && a.d_name == "sp" && a.d_dims.size() == 2 && a.d_dims[1] == 4 && a.d_nzmax == 4 );
+	CHECK( a.getNonZeroCount() == 4 && a.d_img.size() == 4 && a.d_jc.size() == 5 );
+	CHECK( a.getReal( 2, 0 ).toDouble() == 2 && a.getReal( 1, 2 ).toDouble() == 3 && a.getReal( 2, 3 ).toDouble() == 4 );
+	CHECK( a.getReal( 1, 0 ).toDouble() == 0 && !a.getReal( 3, 0 ).isValid() );
+}
+
+static void testLoadAll()
+{
+	QBuffer out;
+	out.open( QIODevice::ReadWrite );
+	{
+		MatWriter w;
+		w.setDevice( &out );
+		for( int k = 0; k < 20; k++ )
+		{
+			MatWriter::Dims dims;
+			dims << 100 << 50;
+			w.beginNumArray( dims, QVariant::Double, false, "v" + QByteArray::number( k ) );
+			for( int i = 0; i < 5000; i++ )
+				w.addNumArrayElement( double( i * k ) );
+			w.endNumArray( k % 3 != 0 );
+		}
+		w.addCharArray( "end", "s" );
+	}
+	QBuffer buf;
+	buf.setData( out.data() );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	QVariantList l = r.loadAll( 4 );
+	CHECK( !r.hasError() && l.size() == 21 );
+	for( int k = 0; k < 20 && k < l.size(); k++ )
+	{
+		NumericArray a = l[k].value<NumericArray>();
+		CHECK( a.d_name == "v" + QByteArray::number( k ) && a.d_real.size() == 5000 );
+		CHECK( a.d_real.size() == 5000 && a.constData<double>()[4999] == 4999.0 * k );
+	}
+	CHECK( l.size() == 21 && l[20].value<String>().d_str == "end" );
+	CHECK( r.nextElement().value<NumericArray>().d_name == "v0" );
+
+	// die Einstellungen des Readers gelten auch in den Tasks
+	for( int columnar = 0; columnar < 2; columnar++ )
+	{
+		QBuffer buf;
+		buf.setData( writeSample( true ) );
+		buf.open( QIODevice::ReadOnly );
+		MatReader r;
+		r.setColumnar( columnar );
+		CHECK( r.setDevice( &buf ) );
+		QExplicitlySharedDataPointer<Arena> arena( new Arena() );
+		r.setArena( arena.data() );
+		Structure s1 = r.load( "st" ).value<Structure>();
+		l = r.loadAll( 2 );
+		CHECK( !r.hasError() && l.size() == 3 );
+		Structure s2 = l.value( 2 ).value<Structure>();
+		CHECK( s1.d_columns.size() == s2.d_columns.size() && s1.d_fields.size() == s2.d_fields.size() );
+		CHECK( !columnar || s2.getColumn( 0 ).size() == 2 );
+		r.setSelection( QList<QByteArray>() << "st.y" << "s" );
+		l = r.loadAll( 2 );
+		CHECK( !r.hasError() && l.size() == 2 && l.value( 0 ).value<String>().d_str == "hello" );
+		s2 = l.value( 1 ).value<Structure>();
+		CHECK( s2.d_name == "st" && !s2.getValue( "x" ).isValid() && s2.getValue( "y" ).isValid() );
+	}
+}
+
+static void testLoadAllBig()
+{
+	// Elemente ueber MatReader::BigElement werden nicht als Ganzes in den Speicher gelesen
+	const int n = MatReader::BigElement / 8 + 1000;
+	QTemporaryFile f;
+	CHECK( f.open() );
+	{
+		MatWriter w;
+		w.setDevice( &f );
+		w.addCharArray( "first", "s" );
+		MatWriter::Dims dims;
+		dims << 1 << n;
+		w.beginNumArray( dims, QVariant::Double, false, "big" );
+		for( int i = 0; i < n; i++ )
+			w.addNumArrayElement( double( i ) );
+		w.endNumArray();
+		w.addCharArray( "last", "t" );
+	}
+	f.reset();
+	QBuffer buf;
+	buf.setData( f.readAll() );
+	buf.open( QIODevice::ReadOnly );
+	f.reset();
+	for( int file = 0; file < 2; file++ )
+	{
+		MatReader r;
+		CHECK( r.setDevice( file ? (QIODevice*)&f : (QIODevice*)&buf ) );
+		const QVariantList l = r.loadAll( 2 );
+		CHECK( !r.hasError() && l.size() == 3 );
+		NumericArray a = l.value( 1 ).value<NumericArray>();
+		CHECK( a.d_name == "big" && a.d_real.size() == n && a.constData<double>()[n - 1] == n - 1 );
+		CHECK( l.value( 0 ).value<String>().d_str == "first" && l.value( 2 ).value<String>().d_str == "last" );
+		CHECK( r.nextElement().value<String>().d_str == "first" );
+	}
+}
+
+static void testBigEndian()
+{
+	s_bigEndian = true;
+	QByteArray i16;
+	for( int i = -9; i <= 9; i++ )
+		_put( i16, qint16( i ) );
+	QList<QByteArray> cells;
+	cells << _scalar( 1.5 ) << _chars( "abc" );
+	const QByteArray data = _header() + _doubles( QVector<double>() << -2.0 << 0.5 << 300.0, "d" ) +
+			_matrix( mxINT16_CLASS, 1, 19, "i16", _element( miINT16, i16 ) ) + _chars( "abc", "u" ) +
+			_compressed( _struct( QList<QByteArray>() << "x" << "y", 1, cells, "st" ) );
+	s_bigEndian = false;
+	for( int doc = 0; doc < 2; doc++ )
+	{
+		QBuffer buf;
+		buf.setData( data );
+		buf.open( QIODevice::ReadOnly );
+		QVariantList l;
+		if( doc )
+		{
+			MatDocument d;
+			CHECK( d.load( &buf ) );
+			l = d.getVariables();
+		}else
+		{
+			MatReader r;
+			CHECK( r.setDevice( &buf ) );
+			QVariant v;
+			while( ( v = r.nextElement() ).isValid() )
+				l << v;
+			CHECK( !r.hasError() );
+		}
+		CHECK( l.size() == 4 );
+		NumericArray a = l.value( 0 ).value<NumericArray>();
+		CHECK( a.d_name == "d" && a.d_real.size() == 3 && a.constData<double>()[0] == -2.0 &&
+			   a.getReal( 2 ).toDouble() == 300.0 );
+		a = l.value( 1 ).value<NumericArray>();
+		CHECK( a.d_real.getType() == NumericBuffer::Int16 && a.getReal( 0 ).toInt() == -9 && a.getReal( 18 ).toInt() == 9 );
+		CHECK( l.value( 2 ).value<String>().d_str == "abc" );
+		Structure s = l.value( 3 ).value<Structure>();
+		CHECK( s.getArray( "x" ).getReal().toDouble() == 1.5 && s.getString( "y" ) == "abc" );
+	}
+}
+
+static void testSwap()
+{
+	for( int es = 2; es <= 8; es *= 2 )
+	{
+		for( int n = 0; n < 70; n++ )
+		{
+			QByteArray a( n * es + 1, 0 );
+			for( int i = 0; i < a.size(); i++ )
+				a[i] = char( i * 7 + es );
+			QByteArray b = a;
+			MatLexer::swapBuffer( b.data() + 1, es, n ); // nicht ausgerichtet
+			bool ok = b[0] == a[0];
+			for( int i = 0; i < n; i++ )
+				for( int j = 0; j < es; j++ )
+					if( b[1 + i * es + j] != a[1 + i * es + es - 1 - j] )
+						ok = false;
+			CHECK( ok );
+		}
+	}
+}
+
+template<class T>
+static QByteArray _array( quint32 miType, quint32 mxClass, int n, const QByteArray& name )
+{
+	QByteArray data;
+	for( int i = 0; i < n; i++ )
+		_put( data, T( i % 100 ) );
+	return _matrix( mxClass, 1, n, name, _element( miType, data ) );
+}
+
+static void testTypes()
+{
+	// gross genug, dass die Daten nicht inline, sondern am Stueck vom Stream gelesen werden
+	const int n = 1001;
+	const QByteArray data = _header() + _array<qint8>( 1, 8, n, "i8" ) + _array<quint8>( 2, 9, n, "u8" ) +
+			_array<qint16>( 3, 10, n, "i16" ) + _array<quint16>( 4, 11, n, "u16" ) +
+			_array<qint32>( 5, 12, n, "i32" ) + _array<quint32>( 6, 13, n, "u32" ) +
+			_array<float>( 7, 7, n, "f" ) + _array<double>( 9, 6, n, "d" ) +
+			_array<qint64>( 12, 14, n, "i64" ) + _array<quint64>( 13, 15, n, "u64" );
+	for( quint32 limit = 0; limit <= 10; limit += 10 )
+	{
+		QBuffer buf;
+		buf.setData( data );
+		buf.open( QIODevice::ReadOnly );
+		MatReader r;
+		r.setLimit( limit );
+		CHECK( r.setDevice( &buf ) );
+		int count = 0;
+		QVariant v;
+		while( ( v = r.nextElement() ).isValid() )
+		{
+			NumericArray a = v.value<NumericArray>();
+			CHECK( a.d_real.size() == ( limit ? int(limit) : n ) );
+			CHECK( a.getReal( 7 ).toInt() == 7 && a.getReal( a.d_real.size() - 1 ).toInt() == ( a.d_real.size() - 1 ) % 100 );
+			count++;
+		}
+		CHECK( !r.hasError() && count == 10 );
+	}
+}
+
+static void testCompact()
+{
+	// MATLAB speichert z.B. ganzzahlige double Werte als miINT8; gelesen wird im Typ der Klasse
+	const QByteArray data = _header() + _array<qint8>( 1, 6, 300, "d" ) + _array<quint8>( 2, 12, 5, "i32" );
+	QBuffer buf;
+	buf.setData( data );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	NumericArray a = r.nextElement().value<NumericArray>();
+	CHECK( a.d_real.getType() == NumericBuffer::Double && a.d_real.size() == 300 && a.constData<double>()[299] == 99.0 );
+	a = r.nextElement().value<NumericArray>();
+	CHECK( a.d_real.getType() == NumericBuffer::Int32 && a.d_real.size() == 5 && a.constData<qint32>()[4] == 4 );
+	CHECK( !r.hasError() );
+
+	// mehr als MaxBytes ergibt einen ungueltigen Buffer statt eines Ueberlaufs
+	CHECK( !NumericBuffer( NumericBuffer::Double, qint64( NumericBuffer::MaxBytes ) / 8 + 1 ).isValid() );
+	NumericBuffer b( NumericBuffer::Int8, 16 );
+	CHECK( !b.resize( qint64( 1 ) << 32 ) && b.size() == 16 );
+	b = NumericBuffer( NumericBuffer::Int8, 0x10000000 );
+	CHECK( b.isValid() && !b.convertTo( NumericBuffer::Double ).isValid() );
+}
+
+static void testCursor( bool compress )
+{
+	QBuffer out;
+	out.open( QIODevice::ReadWrite );
+	{
+		MatWriter w;
+		w.setDevice( &out );
+		w.addCharArray( "x", "s" );
+		MatWriter::Dims dims;
+		dims << 1000 << 5;
+		w.beginNumArray( dims, QVariant::Int, false, "big" );
+		for( int i = 0; i < 5000; i++ )
+			w.addNumArrayElement( i * 3 );
+		w.endNumArray( compress );
+		w.addCharArray( "y", "t" );
+	}
+	QBuffer buf;
+	buf.setData( out.data() );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	ArrayCursor c = r.openArray( "big" );
+	CHECK( !r.hasError() && c.isValid() && c.getCount() == 5000 && c.getType() == NumericBuffer::Int32 );
+	qint64 n = 0;
+	bool ok = true;
+	while( ok && !c.atEnd() )
+	{
+		NumericBuffer b = c.next( 300 );
+		ok = b.size() > 0 && b.size() <= 300;
+		for( int i = 0; ok && i < b.size(); i++, n++ )
+			ok = b.constData<qint32>()[i] == n * 3;
+	}
+	CHECK( ok && n == 5000 );
+	// danach steht der Reader nach der Variable
+	CHECK( r.nextElement().value<String>().d_str == "y" );
+	CHECK( r.load( "t" ).value<String>().d_str == "y" );
+
+	// vorzeitig geloeschter Cursor: ohne Warnung und ebenfalls nach der Variable
+	s_warnings = 0;
+#if QT_VERSION >= 0x050000
+	QtMessageHandler old = qInstallMessageHandler( _countWarnings );
+#else
+	QtMsgHandler old = qInstallMsgHandler( _countWarnings );
+#endif
+	{
+		ArrayCursor c2 = r.openArray( "big" );
+		CHECK( c2.next( 10 ).size() == 10 );
+	}
+#if QT_VERSION >= 0x050000
+	qInstallMessageHandler( old );
+#else
+	qInstallMsgHandler( old );
+#endif
+	CHECK( s_warnings == 0 && !r.hasError() );
+	CHECK( r.nextElement().value<String>().d_str == "y" );
+}
+
+static void testSlab( bool compress )
+{
+	QBuffer out;
+	out.open( QIODevice::ReadWrite );
+	{
+		MatWriter w;
+		w.setDevice( &out );
+		MatWriter::Dims dims;
+		dims << 10 << 6 << 3;
+		w.beginNumArray( dims, QVariant::Double, false, "cube" );
+		for( int i = 0; i < 180; i++ )
+			w.addNumArrayElement( double(i) );
+		w.endNumArray( compress );
+		w.addCharArray( "after", "s" );
+	}
+	QBuffer buf;
+	buf.setData( out.data() );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	QVector<qint32> off, cnt, str;
+	off << 0 << 4 << 0;
+	cnt << 10 << 1 << 1;
+	NumericArray a = r.readSlab( "cube", off, cnt );
+	CHECK( !r.hasError() && a.d_real.size() == 10 && a.getReal( 0 ).toDouble() == 40 && a.getReal( 9 ).toDouble() == 49 );
+	CHECK( r.nextElement().value<String>().d_str == "after" );
+	off.clear();
+	cnt.clear();
+	off << 1 << 2 << 1;
+	cnt << 3 << 2 << 2;
+	str << 3 << 2 << 1;
+	a = r.readSlab( "cube", off, cnt, str );
+	CHECK( !r.hasError() && a.d_real.size() == 12 && a.d_dims.size() == 3 && a.d_dims[0] == 3 );
+	bool ok = a.d_real.size() == 12;
+	for( int z = 0; ok && z < 2; z++ )
+		for( int y = 0; y < 2; y++ )
+			for( int x = 0; x < 3; x++ )
+				if( a.getReal( x, y, z ).toDouble() != ( 1 + x * 3 ) + ( 2 + y * 2 ) * 10 + ( 1 + z ) * 60 )
+					ok = false;
+	CHECK( ok );
+	off.clear();
+	cnt.clear();
+	str.clear();
+	off << 0 << 0 << 0;
+	cnt << 11 << 1 << 1;
+	a = r.readSlab( "cube", off, cnt );
+	CHECK( r.hasError() && !a.isValid() );
+}
+
+static void testDocument()
+{
+	QBuffer buf;
+	buf.setData( writeSample( true ) );
+	buf.open( QIODevice::ReadOnly );
+	MatDocument doc;
+	CHECK( doc.load( &buf ) );
+	CHECK( doc.getVariables().size() == 3 && doc.getArenaSize() > 0 );
+	NumericArray a = doc.getVariable( "a" ).value<NumericArray>();
+	CHECK( a.d_real.getType() == NumericBuffer::Double && a.constData<double>()[5] == 5.5 );
+	CHECK( doc.getVariable( "st" ).value<Structure>().getString( "y" ) == "abc" );
+	NumericArray x = doc.getVariable( "st" ).value<Structure>().d_fields["x"][1].value<NumericArray>();
+	CHECK( x.getReal( qint64( 0 ) ).toInt() == 2 );
+	doc.clear();
+	// die Buffer halten die Arena
+	CHECK( a.constData<double>()[5] == 5.5 && x.getReal( qint64( 0 ) ).toInt() == 2 );
+}
+
+static void testArenaRef()
+{
+	// der Reader haelt eine Referenz; die Arena lebt weiter, auch wenn die ersten Buffer verworfen sind
+	QBuffer buf;
+	buf.setData( writeSample( false ) );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	r.setArena( new Arena() );
+	CHECK( r.setDevice( &buf ) );
+	int n = 0;
+	while( r.nextElement().isValid() )
+		n++;
+	CHECK( n == 3 && !r.hasError() && r.getArena()->getUsed() > 0 );
+}
+
+static void testColumnar()
+{
+	QBuffer out;
+	out.open( QIODevice::ReadWrite );
+	{
+		MatWriter w;
+		w.setDevice( &out );
+		QList<QByteArray> names;
+		names << "t" << "v" << "m";
+		w.beginStructure( names, 4, false, "log" );
+		for( int i = 0; i < 4; i++ )
+			w.addStructureRow( QVariantList() << QVariant( double(i) / 2 ) << QVariant( i * 10 ) <<
+							   ( i == 2 ? QVariant( "x" ) : QVariant( i ) ) );
+		w.endStructure( true );
+	}
+	QBuffer buf;
+	buf.setData( out.data() );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	r.setColumnar( true );
+	CHECK( r.setDevice( &buf ) );
+	Structure s = r.nextElement().value<Structure>();
+	CHECK( !r.hasError() && s.d_names.size() == 3 );
+	const int t = s.getFieldIndex( "t" ), v = s.getFieldIndex( "v" ), m = s.getFieldIndex( "m" );
+	CHECK( s.getColumn( t ).getType() == NumericBuffer::Double && s.getColumn( t ).size() == 4 );
+	CHECK( s.getColumn( t ).size() == 4 && s.getColumn( t ).constData<double>()[3] == 1.5 );
+	CHECK( s.getColumn( v ).getType() == NumericBuffer::Int32 && s.getColumn( v ).constData<qint32>()[2] == 20 );
+	CHECK( !s.getColumn( m ).isValid() && s.d_fields["m"].size() == 4 );
+	CHECK( s.d_fields["m"].size() == 4 && s.d_fields["m"][2].value<String>().d_str == "x" );
+	CHECK( s.getValue( "v" ).value<NumericArray>().getReal().toInt() == 0 );
+
+	// ohne Index, z.B. selbst zusammengestellt
+	Structure u;
+	u.d_names << "a" << "b";
+	CHECK( u.getFieldIndex( "b" ) == 1 && u.getFieldIndex( "c" ) == -1 );
+}
+
+struct CountVisitor : public MatVisitor
+{
+	int d_begins, d_ends, d_values, d_strings, d_names;
+	CountVisitor():d_begins(0),d_ends(0),d_values(0),d_strings(0),d_names(0) {}
+	void beginMatrix( quint8, quint32, const QVector<qint32>&, const QByteArray& ) { d_begins++; }
+	void endMatrix() { d_ends++; }
+	void numericData( quint8, quint8, const void*, qint32 count ) { d_values += count; }
+	void chars( const QString& ) { d_strings++; }
+	void fieldNames( const QList<QByteArray>& l ) { d_names += l.size(); }
+};
+
+static void testVisit( bool compress )
+{
+	QBuffer buf;
+	buf.setData( writeSample( compress ) );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	CountVisitor v;
+	CHECK( r.visit( &v ) && !r.hasError() );
+	// a, s, st und vier Zellen; 6 Werte in a, dazu x(1), x(2) und y(2)
+	CHECK( v.d_begins == 7 && v.d_ends == 7 && v.d_strings == 2 && v.d_names == 2 && v.d_values == 9 );
+}
+
+struct ChunkVisitor : public MatVisitor
+{
+	int d_calls;
+	qint32 d_max;
+	double d_sum;
+	ChunkVisitor():d_calls(0),d_max(0),d_sum(0) {}
+	void numericData( quint8 part, quint8 type, const void* data, qint32 count )
+	{
+		if( part != 0 || type != NumericBuffer::Double )
+			return;
+		d_calls++;
+		d_max = qMax( d_max, count );
+		for( int i = 0; i < count; i++ )
+			d_sum += ( (const double*)data )[i];
+	}
+};
+
+static void testVisitChunks( bool compress )
+{
+	QBuffer out;
+	out.open( QIODevice::ReadWrite );
+	{
+		MatWriter w;
+		w.setDevice( &out );
+		MatWriter::Dims dims;
+		dims << 1 << 300000;
+		QVector<double> re( 300000, 1.0 );
+		w.beginNumArray( dims, QVariant::Double, true, "big" );
+		w.addNumArrayData( re.constData(), re.size() );
+		w.endNumArray( compress );
+	}
+	QBuffer buf;
+	buf.setData( out.data() );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	ChunkVisitor v;
+	CHECK( r.visit( &v ) && !r.hasError() );
+	CHECK( v.d_sum == 300000.0 && v.d_calls == 3 && v.d_max == 131072 );
+}
+
+static void testSelection( bool compress )
+{
+	QBuffer buf;
+	buf.setData( writeSample( compress ) );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	CHECK( !r.setSelection( QList<QByteArray>() << "st{" ) );
+	CHECK( r.setSelection( QList<QByteArray>() << "st(2).y" << "s" ) );
+	CHECK( r.nextElement().value<String>().d_str == "hello" && !r.hasError() );
+	Structure s = r.nextElement().value<Structure>();
+	CHECK( !r.hasError() && s.d_fields["x"].size() == 2 && !s.d_fields["x"][0].isValid() && !s.d_fields["x"][1].isValid() );
+	CHECK( !s.d_fields["y"][0].isValid() && s.d_fields["y"][1].value<NumericArray>().getReal().toDouble() == 3.5 );
+	CHECK( !r.nextElement().isValid() && !r.hasError() );
+}
+
+class CountingBuffer : public QBuffer
+{
+public:
+	qint64 d_read;
+	CountingBuffer():d_read(0) {}
+protected:
+	qint64 readData( char* data, qint64 len )
+	{
+		const qint64 n = QBuffer::readData( data, len );
+		if( n > 0 )
+			d_read += n;
+		return n;
+	}
+};
+
+static void testSkip()
+{
+	// nicht benoetigte unkomprimierte Elemente werden per seek uebersprungen, nicht gelesen
+	QBuffer out;
+	out.open( QIODevice::ReadWrite );
+	{
+		MatWriter w;
+		w.setDevice( &out );
+		MatWriter::Dims dims;
+		dims << 1000 << 100;
+		w.beginNumArray( dims, QVariant::Double, false, "big" );
+		for( int i = 0; i < 100000; i++ )
+			w.addNumArrayElement( double( i ) );
+		w.endNumArray();
+		w.addCharArray( "hello", "s" );
+	}
+	const qint64 size = out.data().size();
+	{
+		CountingBuffer buf;
+		buf.setData( out.data() );
+		buf.open( QIODevice::ReadOnly );
+		MatReader r;
+		CHECK( r.setDevice( &buf ) );
+		CHECK( r.readDirectory().size() == 2 && r.load( "s" ).value<String>().d_str == "hello" );
+		CHECK( buf.d_read < size / 4 );
+	}
+	{
+		CountingBuffer buf;
+		buf.setData( out.data() );
+		buf.open( QIODevice::ReadOnly );
+		MatReader r;
+		CHECK( r.setDevice( &buf ) );
+		CHECK( r.setSelection( QList<QByteArray>() << "s" ) );
+		CHECK( r.nextElement().value<String>().d_str == "hello" && !r.hasError() );
+		CHECK( buf.d_read < size / 4 );
+	}
+}
+
+static void testPreview()
+{
+	QBuffer out;
+	out.open( QIODevice::ReadWrite );
+	{
+		MatWriter w;
+		w.setDevice( &out );
+		MatWriter::Dims dims;
+		dims << 1 << 100000;
+		w.beginNumArray( dims, QVariant::Double, false, "big" );
+		for( int i = 0; i < 100000; i++ )
+			w.addNumArrayElement( double(i) );
+		w.endNumArray( true );
+		QList<QByteArray> names;
+		names << "x" << "y";
+		w.beginStructure( names, 30, false, "st" );
+		for( int i = 0; i < 30; i++ )
+			w.addStructureRow( QVariantList() << QVariant( i ) << QVariant( double(i) ) );
+		w.endStructure( true );
+		w.addCharArray( "end", "s" );
+	}
+	for( int preview = 0; preview < 2; preview++ )
+	{
+		QBuffer buf;
+		buf.setData( out.data() );
+		buf.open( QIODevice::ReadOnly );
+		MatReader r;
+		r.setLimit( 10 );
+		r.setPreview( preview );
+		CHECK( r.setDevice( &buf ) );
+		NumericArray a = r.nextElement().value<NumericArray>();
+		CHECK( !r.hasError() && a.d_name == "big" && a.d_real.size() == 10 && a.constData<double>()[9] == 9.0 );
+		Structure st = r.nextElement().value<Structure>();
+		CHECK( !r.hasError() && st.d_name == "st" && st.d_fields["x"].size() == 10 && st.d_fields["y"].size() == 10 );
+		CHECK( r.nextElement().value<String>().d_str == "end" && !r.hasError() );
+		CHECK( !r.nextElement().isValid() && !r.hasError() );
+	}
+	QBuffer buf;
+	buf.setData( out.data() );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	r.setLimit( 70000 );
+	CHECK( r.setDevice( &buf ) );
+	NumericArray a = r.nextElement().value<NumericArray>();
+	CHECK( a.d_real.size() == 70000 && a.getReal( qint64( 69999 ) ).toDouble() == 69999.0 );
+}
+
+static void testPreviewNested( bool compress )
+{
+	// o.inner(2).a ist limitiert; inner(k).b, o.tail und die folgende Variable duerfen nicht verloren gehen
+	QVector<double> big;
+	for( int i = 0; i < 100; i++ )
+		big << i;
+	QList<QByteArray> inner, outer;
+	inner << _doubles( big ) << _scalar( 7.0 ) << _doubles( big ) << _scalar( 8.0 );
+	outer << _struct( QList<QByteArray>() << "a" << "b", 2, inner ) << _scalar( 9.0 );
+	const QByteArray o = _struct( QList<QByteArray>() << "inner" << "tail", 1, outer, "o" );
+	const QByteArray data = _header() + ( compress ? _compressed( o ) : o ) + _chars( "end", "s" );
+	for( int preview = 0; preview < 2; preview++ )
+	{
+		for( int limit = 0; limit <= 50; limit += 25 )
+		{
+			QBuffer buf;
+			buf.setData( data );
+			buf.open( QIODevice::ReadOnly );
+			MatReader r;
+			r.setLimit( limit );
+			r.setPreview( preview );
+			CHECK( r.setDevice( &buf ) );
+			Structure st = r.nextElement().value<Structure>();
+			CHECK( !r.hasError() && st.d_name == "o" && st.d_fields["inner"].size() == 1 );
+			CHECK( st.getArray( "tail" ).getReal().toDouble() == 9.0 );
+			Structure in = st.getValue( "inner" ).value<Structure>();
+			CHECK( in.d_fields["a"].size() == 2 && in.d_fields["b"].size() == 2 );
+			if( in.d_fields["a"].size() == 2 && in.d_fields["b"].size() == 2 )
+			{
+				const NumericArray a = in.d_fields["a"][1].value<NumericArray>();
+				CHECK( a.d_real.size() == ( limit ? limit : 100 ) && a.constData<double>()[a.d_real.size() - 1] ==
+					   a.d_real.size() - 1 );
+				CHECK( in.d_fields["b"][0].value<NumericArray>().getReal().toDouble() == 7.0 );
+				CHECK( in.d_fields["b"][1].value<NumericArray>().getReal().toDouble() == 8.0 );
+			}
+			CHECK( r.nextElement().value<String>().d_str == "end" && !r.hasError() );
+			CHECK( !r.nextElement().isValid() && !r.hasError() );
+		}
+	}
+}
+
+static void testPool()
+{
+	// die Lexer der inneren Ebenen werden wiederverwendet; der Pool waechst nur bis zur Verschachtelungstiefe
+	QBuffer buf;
+	buf.setData( writeSample( false ) );
+	buf.open( QIODevice::ReadOnly );
+	MatParser p;
+	CHECK( p.setDevice( &buf ) );
+	int pool = -1;
+	for( int pass = 0; pass < 2; pass++ )
+	{
+		int depth = 0, maxDepth = 0;
+		MatParser::Token t;
+		while( ( t = p.nextToken() ).d_type != MatParser::Null && t.d_type != MatParser::Error )
+		{
+			if( t.d_type == MatParser::BeginMatrix )
+				maxDepth = qMax( maxDepth, ++depth );
+			else if( t.d_type == MatParser::EndMatrix )
+				depth--;
+		}
+		CHECK( t.d_type == MatParser::Null && depth == 0 && maxDepth == 2 );
+		CHECK( p.getPoolSize() == maxDepth && ( pool == -1 || pool == p.getPoolSize() ) );
+		pool = p.getPoolSize();
+		CHECK( p.rewind() );
+	}
+}
+
+static void testLimits()
+{
+	// ein Element ueber 4 GB wird abgelehnt statt mit abgeschnittenem Tag geschrieben
+	QBuffer buf;
+	buf.open( QIODevice::WriteOnly );
+	MatWriter w;
+	w.setDevice( &buf );
+	const qint64 header = buf.size();
+	MatWriter::Dims dims;
+	dims << 70000 << 70000;
+	w.beginNumArray( dims, QVariant::Double, true, "huge" );
+	CHECK( w.hasError() );
+	w.addNumArrayElement( 1.0 );
+	w.endNumArray();
+	w.addCharArray( "abc", "s" );
+	w.flush();
+	CHECK( buf.size() == header );
+	QBuffer buf2;
+	buf2.open( QIODevice::WriteOnly );
+	w.setDevice( &buf2 );
+	CHECK( !w.hasError() );
+
+	// Indizes und Groessen ueber 32 Bit
+	NumericArray a;
+	a.allocReal( 70000, 70000 );
+	CHECK( !a.d_real.isValid() );
+	a.allocReal( 3, 2, 1.5 );
+	CHECK( a.d_real.size() == 6 && a.getReal( qint64(2), qint64(1) ).toDouble() == 1.5 );
+	CHECK( !a.getReal( qint64(0), qint64(0x100000000LL) ).isValid() );
+	CellArray c;
+	c.d_dims << 1 << 1;
+	c.d_cells << 7;
+	CHECK( c.getValue( 0 ).toInt() == 7 && !c.getValue( 0x100000000LL ).isValid() );
+}
+
+class LoaderSpy : public QObject
+{
+	Q_OBJECT
+public:
+	MatLoader* d_loader;
+	int d_vars; // Variablen des aktuellen Laufs
+	int d_loaded;
+	int d_stale; // Signale frueherer Laeufe
+	LoaderSpy( MatLoader* l ):d_loader(l),d_vars(0),d_loaded(0),d_stale(0)
+	{
+		connect( l, SIGNAL(variableLoaded(int,QVariant)), this, SLOT(onVariableLoaded(int,QVariant)) );
+		connect( l, SIGNAL(loaded(int)), this, SLOT(onLoaded(int)) );
+	}
+public slots:
+	void onVariableLoaded( int run, const QVariant& )
+	{
+		if( run == d_loader->getRun() )
+			d_vars++;
+		else
+			d_stale++;
+	}
+	void onLoaded( int run )
+	{
+		if( run == d_loader->getRun() )
+			d_loaded++;
+		else
+			d_stale++;
+	}
+};
+
+static void testLoader()
+{
+	QTemporaryFile f;
+	CHECK( f.open() );
+	f.write( writeSample( false ) );
+	f.flush();
+	f.reset();
+	MatReader r;
+	CHECK( r.setDevice( &f ) );
+	const int count = r.loadAll().size();
+	CHECK( count > 0 );
+
+	// wie in MainWindow::showFile; der erste Lauf ist beendet, seine Signale stehen aber noch in der Queue
+	MatLoader l;
+	LoaderSpy spy( &l );
+	CHECK( l.load( f.fileName() ) && l.getRun() == 1 );
+	l.wait();
+	CHECK( l.load( f.fileName() ) && l.getRun() == 2 );
+	l.wait();
+	QCoreApplication::processEvents();
+	CHECK( spy.d_vars == count && spy.d_loaded == 1 && spy.d_stale == count + 1 );
+	CHECK( l.getError().isEmpty() && !l.isCanceled() );
+
+	// ein Abbruch wirkt auch innerhalb einer Variable
+	QTemporaryFile big;
+	CHECK( big.open() );
+	{
+		MatWriter w;
+		w.setDevice( &big );
+		const QVector<double> data( 1 << 20, 1.0 );
+		MatWriter::Dims dims;
+		dims << 1 << data.size();
+		w.beginNumArray( dims, QVariant::Double, false, "big" );
+		w.addNumArrayData( data.constData(), data.size() );
+		w.endNumArray();
+	}
+	big.flush();
+	MatLoader c;
+	MatLoader::File in( big.fileName(), &c );
+	CHECK( in.open( QIODevice::ReadOnly ) );
+	MatReader r2;
+	CHECK( r2.setDevice( &in ) );
+	c.cancel();
+	CHECK( !r2.nextElement().isValid() ); // je nach Pufferung von QFile als Fehler oder Dateiende
+
+	// ein abgebrochener Lauf meldet keinen Fehler
+	LoaderSpy spy2( &c );
+	CHECK( c.load( big.fileName() ) );
+	c.cancel();
+	c.wait();
+	QCoreApplication::processEvents();
+	CHECK( c.isCanceled() && c.getError().isEmpty() && spy2.d_loaded == 1 );
+}
+
+static void testBulkWrite( bool compress )
+{
+	QBuffer out;
+	out.open( QIODevice::ReadWrite );
+	{
+		MatWriter w;
+		w.setDevice( &out );
+		MatWriter::Dims dims;
+		dims << 3 << 1000;
+		QVector<double> re( 3000 ), im( 3000 );
+		for( int i = 0; i < 3000; i++ )
+		{
+			re[i] = i * 0.5;
+			im[i] = -i;
+		}
+		w.beginNumArray( dims, QVariant::Double, false, "z", true );
+		w.addNumArrayData( re.constData(), 1000 );
+		w.addNumArrayData( re.constData() + 1000, 2000 );
+		w.addNumArrayData( im.constData(), 3000 );
+		w.endNumArray( compress );
+		dims.clear();
+		dims << 1 << 5;
+		w.beginNumArray( dims, QMetaType::UChar, false, "b" );
+		w.addNumArrayElement( QByteArray( "\x01\x02\x03\x04\x05" ) );
+		w.endNumArray( compress );
+		dims.clear();
+		dims << 1 << 0;
+		w.beginNumArray( dims, QVariant::Int, false, "e", true );
+		w.endNumArray( compress );
+	}
+	QBuffer buf;
+	buf.setData( out.data() );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	NumericArray a = r.nextElement().value<NumericArray>();
+	CHECK( !r.hasError() && a.d_name == "z" && a.d_real.size() == 3000 && a.d_img.size() == 3000 );
+	CHECK( a.constData<double>()[2999] == 1499.5 && a.constImgData<double>()[1234] == -1234.0 );
+	a = r.nextElement().value<NumericArray>();
+	CHECK( !r.hasError() && a.d_real.size() == 5 && a.constData<quint8>()[4] == 5 );
+	a = r.nextElement().value<NumericArray>();
+	CHECK( !r.hasError() && a.d_name == "e" && a.d_real.size() == 0 );
+}
+
+static void testDirect()
+{
+	// direkt geschriebene Variablen mit nachgetragener Laenge entsprechen byte-genau den gepufferten
+	const QByteArray a = writeSample( false ), b = writeSample( false, true );
+	CHECK( a.mid( 128 ) == b.mid( 128 ) ); // Header enthaelt die Zeit
+	QBuffer buf;
+	buf.setData( b );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	const QVariantList l = r.loadAll();
+	CHECK( !r.hasError() && l.size() == 3 );
+	CHECK( l.value( 0 ).value<NumericArray>().getReal( 1, 2 ).toDouble() == 5.5 );
+	CHECK( l.value( 2 ).value<Structure>().getString( "y" ) == "abc" );
+}
+
+class SequentialDevice : public QIODevice
+{
+public:
+	QByteArray d_data;
+	bool isSequential() const { return true; }
+protected:
+	qint64 readData( char*, qint64 ) { return -1; }
+	qint64 writeData( const char* data, qint64 len )
+	{
+		d_data.append( data, int( len ) );
+		return len;
+	}
+};
+
+static void testCompressedWrite()
+{
+	// seekbar wird direkt ins Ziel deflatet, sequentiell ueber eine temporaere Datei; das Ergebnis ist gleich
+	QByteArray res[2];
+	for( int seq = 0; seq < 2; seq++ )
+	{
+		QBuffer plain;
+		SequentialDevice sequential;
+		QIODevice* out = ( seq ) ? (QIODevice*)&sequential : (QIODevice*)&plain;
+		out->open( QIODevice::WriteOnly );
+		{
+			MatWriter w;
+			w.setDevice( out );
+			MatWriter::Dims dims;
+			dims << 1 << 10000;
+			QVector<double> re( 10000 );
+			for( int i = 0; i < re.size(); i++ )
+				re[i] = i % 100;
+			w.beginNumArray( dims, QVariant::Double, false, "a" );
+			w.addNumArrayData( re.constData(), re.size() );
+			w.endNumArray( true );
+			w.addCharArray( "end", "s" );
+		}
+		res[seq] = ( seq ) ? sequential.d_data : plain.data();
+	}
+	CHECK( res[0].mid( 128 ) == res[1].mid( 128 ) ); // Header enthaelt die Zeit
+	CHECK( res[0].size() < 128 + 10000 * 8 / 4 );
+	QBuffer buf;
+	buf.setData( res[0] );
+	buf.open( QIODevice::ReadOnly );
+	MatReader r;
+	CHECK( r.setDevice( &buf ) );
+	NumericArray a = r.nextElement().value<NumericArray>();
+	CHECK( !r.hasError() && a.d_name == "a" && a.d_real.size() == 10000 && a.constData<double>()[9999] == 99 );
+	CHECK( r.nextElement().value<String>().d_str == "end" && !r.hasError() );
+}
+
+static void testParallel()
+{
+	// Mit Threads muss byte-genau dasselbe herauskommen wie seriell
+	QByteArray serial;
+	for( int threads = 0; threads <= 3; threads += 3 )
+	{
+		QBuffer out;
+		out.open( QIODevice::ReadWrite );
+		{
+			MatWriter w;
+			w.setCompressionThreads( threads );
+			w.setDevice( &out );
+			for( int v = 0; v < 20; v++ )
+			{
+				MatWriter::Dims dims;
+				dims << 1 << 500 + v;
+				QVector<double> re( 500 + v );
+				for( int i = 0; i < re.size(); i++ )
+					re[i] = v * 1000 + i;
+				w.beginNumArray( dims, QVariant::Double, v % 2, "v" + QByteArray::number( v ) );
+				w.addNumArrayData( re.constData(), re.size() );
+				w.endNumArray( v % 3 != 0 );
+			}
+		}
+		if( threads == 0 )
+			serial = out.data();
+		else
+			CHECK( out.data().mid( 128 ) == serial.mid( 128 ) ); // Header enthaelt die Zeit
+		QBuffer buf;
+		buf.setData( out.data() );
+		buf.open( QIODevice::ReadOnly );
+		MatReader r;
+		CHECK( r.setDevice( &buf ) );
+		for( int v = 0; v < 20; v++ )
+		{
+			NumericArray a = r.nextElement().value<NumericArray>();
+			CHECK( !r.hasError() && a.d_name == "v" + QByteArray::number( v ) && a.d_real.size() == 500 + v );
+			CHECK( a.d_real.size() == 500 + v && a.constData<double>()[7] == v * 1000 + 7 );
+		}
+	}
+}
+
+int main( int argc, char** argv )
+{
+	QCoreApplication app( argc, argv ); // fuer die Signale von MatLoader
+	testBlocks();
+	testRead( false );
+	testRead( true );
+	testMapped();
+	testDirectory( false );
+	testDirectory( true );
+	testLazy( false, false );
+	testLazy( false, true );
+	testLazy( true, false );
+	testLazy( true, true );
+	testLazySettings();
+	testSparse( false );
+	testSparse( true );
+	testLoadAll();
+	testLoadAllBig();
+	testBigEndian();
+	testSwap();
+	testTypes();
+	testCompact();
+	testCursor( false );
+	testCursor( true );
+	testSlab( false );
+	testSlab( true );
+	testDocument();
+	testArenaRef();
+	testColumnar();
+	testVisit( false );
+	testVisit( true );
+	testVisitChunks( false );
+	testVisitChunks( true );
+	testSelection( false );
+	testSelection( true );
+	testSkip();
+	testPreview();
+	testPreviewNested( false );
+	testPreviewNested( true );
+	testPool();
+	testLimits();
+	testLoader();
+	testBulkWrite( false );
+	testBulkWrite( true );
+	testDirect();
+	testCompressedWrite();
+	testParallel();
+	if( s_failures )
+		qWarning() << s_failures << "checks failed";
+	else
+		qDebug() << "all checks passed";
+	return s_failures != 0;
+}
+
+#include "MatTest.moc"